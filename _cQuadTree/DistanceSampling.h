@@ -0,0 +1,289 @@
+//
+//  DistanceSampling.h
+//
+//  Estimate the distribution of pairwise distances of the points
+//  in a tree from a stratified sample of query points.
+//
+
+#ifndef DistanceSampling_h
+#define DistanceSampling_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Histogram.h>
+#include <Parallel.h>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <unordered_set>
+
+using namespace std;
+
+// result of `estimate_distance_histogram`
+class DistanceHistogramEstimate
+{
+  public:
+    vector < double > histogram;   // estimated number of (ordered) point pairs per bin
+    vector < double > variance;    // estimated variance of the histogram entries
+    size_t number_of_strata = 0;
+    size_t number_of_samples = 0;  // number of query points that were evaluated
+};
+
+// collect the nodes that contain at most `max_points` points
+// (or are leaves), such that every point belongs to exactly one stratum
+inline void get_strata(const QuadTree* node, size_t max_points, vector < const QuadTree* > &strata){
+
+    if (node->is_empty())
+        return;
+
+    if (node->is_leaf() || node->number_of_contained_points <= max_points){
+        strata.push_back(node);
+        return;
+    }
+
+    node->_refine_if_lazy();
+    for(auto &subtree: node->subtrees.trees)
+        if (subtree != NULL)
+            get_strata(subtree, max_points, strata);
+}
+
+// A stratum is a run of neighboring nodes from `get_strata`,
+// its points are the points below these nodes.
+class Stratum
+{
+  public:
+    vector < const QuadTree* > nodes;
+    size_t number_of_points = 0;
+};
+
+// Merge consecutive nodes (which are neighbors in the tree) into strata
+// of at least `ceil(N/max_number_of_strata)` points (except for the last
+// one), such that there are at most `max_number_of_strata` strata.
+inline vector < Stratum > merge_strata(
+              const vector < const QuadTree* > &nodes,
+              size_t number_of_points,
+              size_t max_number_of_strata
+            )
+{
+    size_t min_points = (number_of_points + max_number_of_strata - 1) / max_number_of_strata;
+
+    vector < Stratum > strata;
+    Stratum stratum;
+    for(size_t i = 0; i < nodes.size(); ++i){
+        stratum.nodes.push_back(nodes[i]);
+        stratum.number_of_points += nodes[i]->number_of_contained_points;
+        if (stratum.number_of_points >= min_points || i + 1 == nodes.size()){
+            strata.push_back(stratum);
+            stratum = Stratum();
+        }
+    }
+    return strata;
+}
+
+// draw `n` distinct integers from [0, N) uniformly at random (Floyd's
+// algorithm), or return all of them if `n >= N`
+template < typename Generator >
+vector < size_t > sample_without_replacement(size_t N, size_t n, Generator &generator){
+
+    vector < size_t > sample;
+    if (n >= N){
+        sample.resize(N);
+        iota(sample.begin(), sample.end(), 0);
+        return sample;
+    }
+
+    unordered_set < size_t > chosen;
+    for(size_t j = N - n; j < N; ++j){
+        uniform_int_distribution < size_t > draw(0, j);
+        size_t t = draw(generator);
+        if (!chosen.insert(t).second){
+            chosen.insert(j);
+            t = j;
+        }
+        sample.push_back(t);
+    }
+    return sample;
+}
+
+// find the leaf that holds the point with rank `target` among the points
+// below `node`, where points are ranked in the order of the subtrees
+inline const QuadTree* get_leaf_of_rank(const QuadTree* node, size_t target){
+
+    while (!node->is_leaf()){
+
+        const QuadTree* next = NULL;
+        node->_refine_if_lazy();
+        for(auto &subtree: node->subtrees.trees){
+            QuadTree* _subtree = subtree;
+            if (_subtree == NULL)
+                continue;
+            next = _subtree;
+            if (target < _subtree->number_of_contained_points)
+                break;
+            target -= _subtree->number_of_contained_points;
+        }
+        node = next;
+    }
+
+    return node;
+}
+
+// same as above for the points of a stratum
+inline const QuadTree* get_leaf_of_rank(const Stratum &stratum, size_t target){
+
+    const QuadTree* node = stratum.nodes.back();
+    for(auto _node: stratum.nodes){
+        if (target < _node->number_of_contained_points){
+            node = _node;
+            break;
+        }
+        target -= _node->number_of_contained_points;
+    }
+
+    return get_leaf_of_rank(node, target);
+}
+
+// Estimate the histogram of distances between all (ordered) pairs of points
+// in the tree. The tree is cut into at most `number_of_strata` strata of
+// neighboring nodes, query points are drawn without replacement from every
+// stratum proportionally to its size, and the distances of every query point
+// to all other points are computed with the Barnes-Hut algorithm (cutoff
+// `theta`). The histogram entries and their variances are estimated with the
+// stratified mean estimator, including the finite population correction.
+// At most `sample_budget` query points are evaluated (at least one per
+// stratum), so the cost scales with `sample_budget`, not with the number
+// of points in the tree. If `sample_budget` is at least the number of
+// points, every point is evaluated and the variance vanishes. Strata with
+// a single sample don't contribute to the estimated variance.
+inline DistanceHistogramEstimate estimate_distance_histogram(
+              const QuadTree &tree,
+              const vector < double > &bin_edges,
+              size_t sample_budget,
+              double theta = 0.2,
+              size_t number_of_strata = 0,
+              unsigned int seed = 0,
+              size_t n_threads = 0
+            )
+{
+    if (sample_budget == 0)
+        throw invalid_argument("sample_budget must be positive");
+
+    HistogramBins bins(bin_edges);
+    size_t n_bins = bins.number_of_bins();
+    size_t N = tree.number_of_contained_points;
+
+    DistanceHistogramEstimate estimate;
+    estimate.histogram.assign(n_bins, 0.0);
+    estimate.variance.assign(n_bins, 0.0);
+
+    if (N == 0)
+        return estimate;
+
+    // aim for a few samples per stratum, such that variances can be estimated,
+    // every stratum needs at least one sample
+    if (number_of_strata == 0)
+        number_of_strata = max((size_t) 1, sample_budget / 4);
+    number_of_strata = min(number_of_strata, sample_budget);
+
+    // on clustered data, many nodes are much smaller than N/number_of_strata
+    vector < const QuadTree* > nodes;
+    get_strata(&tree, max((size_t) 1, N / number_of_strata), nodes);
+    vector < Stratum > strata = merge_strata(nodes, N, number_of_strata);
+    estimate.number_of_strata = strata.size();
+
+    // proportional allocation of the samples that are left after every
+    // stratum got one (largest remainder method), which keeps the total
+    // within the budget
+    size_t remaining_budget = sample_budget - strata.size();
+    vector < size_t > number_of_samples(strata.size());
+    vector < pair < double, size_t > > remainders;
+    size_t number_of_allocated_samples = 0;
+    for(size_t h = 0; h < strata.size(); ++h){
+        size_t N_h = strata[h].number_of_points;
+        double quota = (double) remaining_budget * N_h / N;
+        number_of_samples[h] = min(N_h, 1 + (size_t) floor(quota));
+        number_of_allocated_samples += number_of_samples[h] - 1;
+        if (number_of_samples[h] < N_h)
+            remainders.push_back(make_pair(quota - floor(quota), h));
+    }
+    sort(remainders.begin(), remainders.end(), greater < pair < double, size_t > >());
+    for(size_t i = 0; i < remainders.size() && number_of_allocated_samples < remaining_budget; ++i){
+        number_of_samples[remainders[i].second] += 1;
+        ++number_of_allocated_samples;
+    }
+    // samples that didn't fit into strata that are already fully
+    // sampled go to the other strata
+    for(size_t h = 0; h < strata.size() && number_of_allocated_samples < remaining_budget; ++h){
+        size_t extra = min(strata[h].number_of_points - number_of_samples[h],
+                           remaining_budget - number_of_allocated_samples);
+        number_of_samples[h] += extra;
+        number_of_allocated_samples += extra;
+    }
+    for(auto n_h: number_of_samples)
+        estimate.number_of_samples += n_h;
+
+    n_threads = get_number_of_threads(n_threads);
+    vector < vector < double > > thread_histograms(n_threads, vector < double >(n_bins, 0.0));
+    vector < vector < double > > thread_variances(n_threads, vector < double >(n_bins, 0.0));
+
+    parallel_for(strata.size(), n_threads, [&](size_t h, size_t thread_id){
+
+        // every stratum has its own generator, such that the result
+        // does not depend on the number of threads
+        seed_seq sequence = {seed, (unsigned int) h};
+        mt19937_64 generator(sequence);
+
+        size_t n_h = number_of_samples[h];
+        double N_h = (double) strata[h].number_of_points;
+
+        vector < double > sum(n_bins, 0.0);
+        vector < double > sum_of_squares(n_bins, 0.0);
+        vector < double > x(n_bins);
+        vector < pair < double, size_t > > distances;
+
+        for(size_t rank: sample_without_replacement(strata[h].number_of_points, n_h, generator)){
+
+            const QuadTree* leaf = get_leaf_of_rank(strata[h], rank);
+
+            distances.clear();
+            tree.get_distances_to(leaf->this_pos, distances, theta, true);
+
+            fill(x.begin(), x.end(), 0.0);
+            for(auto const &distance: distances){
+                long b = bins.get_bin(distance.first);
+                if (b >= 0)
+                    x[b] += distance.second;
+            }
+
+            for(size_t b = 0; b < n_bins; ++b){
+                sum[b] += x[b];
+                sum_of_squares[b] += x[b]*x[b];
+            }
+        }
+
+        for(size_t b = 0; b < n_bins; ++b){
+            double mean = sum[b] / n_h;
+            thread_histograms[thread_id][b] += N_h * mean;
+            if (n_h > 1){
+                double sample_variance = (sum_of_squares[b] - n_h * mean * mean) / (n_h - 1);
+                double finite_population_correction = 1.0 - n_h / N_h;
+                thread_variances[thread_id][b] += N_h * N_h * finite_population_correction
+                                                  * max(sample_variance, 0.0) / n_h;
+            }
+        }
+    }, "traverse");
+
+    for(size_t t = 0; t < n_threads; ++t)
+        for(size_t b = 0; b < n_bins; ++b){
+            estimate.histogram[b] += thread_histograms[t][b];
+            estimate.variance[b] += thread_variances[t][b];
+        }
+
+    return estimate;
+}
+
+#endif /* DistanceSampling_h */
@@ -0,0 +1,427 @@
+//
+//  FastMultipoleMethod.h
+//
+//  Forces and potentials of all points in linear time with
+//  complex-variable multipole expansions on top of a QuadTree.
+//
+
+#ifndef FastMultipoleMethod_h
+#define FastMultipoleMethod_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+// Results are indexed by point id, so sparse ids (e.g. of a tree that was
+// filled with a large `first_id`) lead to mostly empty result rows. The
+// number of rows may exceed this many rows per point, or the minimum below.
+const size_t _FMM_MAX_ROWS_PER_POINT = 4;
+const size_t _FMM_MIN_ROWS = 1048576;
+
+typedef complex < double > Complex;
+
+// a node of the tree as seen by the FMM, expansions are centered
+// at the node's center of mass, `radius` is the largest distance
+// of a point within the node's box to this center
+class FMMNode
+{
+  public:
+    const QuadTree* tree;
+    Complex center;
+    double radius = 0.0;
+    size_t children[4];
+    size_t number_of_children = 0;
+    bool is_leaf = false;
+};
+
+// The Fast Multipole Method for the 2D Newtonian (logarithmic) potential
+//
+//     phi(x) = sum_j m_j log|x - x_j|,   F(x) = -grad phi(x) = sum_j m_j (x_j - x) / |x_j - x|^2,
+//
+// using complex-variable expansions of order `order` (Greengard & Rokhlin).
+// Multipole expansions are built bottom-up (P2M, M2M), cells are paired
+// with a dual-tree traversal, where well-separated pairs are translated into
+// local expansions (M2L, or evaluated right away for single points, M2P) and
+// neighboring leaves interact directly (P2P). Local expansions are then
+// passed down to the leaves (L2L, L2P). Two cells are well separated if
+// (r_A + r_B) < theta |c_A - c_B|, the error decreases like theta^order.
+//
+// Note that this is the 1/r force of 2D gravity, not the 1/r^2 force
+// that `QuadTree::compute_force` evaluates: the potential 1/r is not
+// harmonic in the plane and can't be expanded in complex variables.
+class FastMultipoleMethod
+{
+  private:
+    vector < FMMNode > nodes;
+    vector < Complex > multipoles;       // (order+1) coefficients per node
+    vector < Complex > locals;           // (order+1) coefficients per node
+    vector < vector < double > > binomials;
+    vector < size_t > top_nodes;         // nodes above the frontier in breadth-first order
+    vector < size_t > frontier;          // roots of disjoint subtrees that are processed in parallel
+
+    Complex* get_multipole(size_t i){
+        return multipoles.data() + i * (order+1);
+    }
+
+    Complex* get_local(size_t i){
+        return locals.data() + i * (order+1);
+    }
+
+    // copy the tree structure in pre-order, returns the index of the node
+    size_t _add_node(const QuadTree* tree){
+
+        size_t index = nodes.size();
+        nodes.push_back(FMMNode());
+        nodes[index].tree = tree;
+        nodes[index].is_leaf = tree->is_leaf();
+
+        if (nodes[index].is_leaf){
+            nodes[index].center = Complex(tree->this_pos.x, tree->this_pos.y);
+            return index;
+        }
+
+        Point com = tree->center_of_mass;
+        nodes[index].center = Complex(com.x, com.y);
+        nodes[index].radius = sqrt(tree->get_point_bounds().get_max_distance2_to(com));
+
+        tree->_refine_if_lazy();
+        for(auto &subtree: tree->subtrees.trees){
+            const QuadTree* _subtree = subtree;
+            if (_subtree == NULL || _subtree->is_empty())
+                continue;
+            size_t child = _add_node(_subtree);
+            nodes[index].children[nodes[index].number_of_children++] = child;
+        }
+
+        return index;
+    }
+
+    // split the tree into enough disjoint subtrees to keep all threads busy
+    void _get_frontier(size_t n_threads){
+
+        top_nodes.clear();
+        frontier.assign(1, 0);
+
+        while (frontier.size() < 8 * n_threads){
+            vector < size_t > next;
+            bool split = false;
+            for(auto i: frontier){
+                if (nodes[i].is_leaf){
+                    next.push_back(i);
+                    continue;
+                }
+                split = true;
+                top_nodes.push_back(i);
+                for(size_t c = 0; c < nodes[i].number_of_children; ++c)
+                    next.push_back(nodes[i].children[c]);
+            }
+            frontier.swap(next);
+            if (!split)
+                break;
+        }
+    }
+
+    // multipole expansion of a leaf (P2M) or of the children's expansions (M2M)
+    void _upward(size_t i){
+
+        FMMNode &node = nodes[i];
+        Complex* a = get_multipole(i);
+
+        if (node.is_leaf){
+            // a leaf's expansion is centered at its point
+            a[0] = node.tree->total_mass;
+            return;
+        }
+
+        for(size_t c = 0; c < node.number_of_children; ++c){
+            _upward(node.children[c]);
+            _multipole_to_multipole(node.children[c], i);
+        }
+    }
+
+    // shift the multipole expansion of `child` to the center of `parent`
+    void _multipole_to_multipole(size_t child, size_t parent){
+
+        const Complex* a = get_multipole(child);
+        Complex* b = get_multipole(parent);
+        Complex z0 = nodes[child].center - nodes[parent].center;
+
+        b[0] += a[0];
+
+        Complex z0_l = 1.0;
+        for(size_t l = 1; l <= order; ++l){
+            z0_l *= z0;
+            Complex sum = -a[0] * z0_l / (double) l;
+            Complex z0_lk = 1.0; // z0^(l-k)
+            for(size_t k = l; k >= 1; --k){
+                sum += a[k] * z0_lk * binomials[l-1][k-1];
+                z0_lk *= z0;
+            }
+            b[l] += sum;
+        }
+    }
+
+    // convert the multipole expansion of `source` into a local expansion around `target`
+    void _multipole_to_local(size_t source, size_t target){
+
+        const Complex* a = get_multipole(source);
+        Complex* b = get_local(target);
+        Complex z0 = nodes[source].center - nodes[target].center;
+        Complex inverse_z0 = 1.0 / z0;
+
+        // a_k (-1)^k / z0^k
+        thread_local vector < Complex > c;
+        c.assign(order+1, 0.0);
+        Complex power = 1.0;
+        for(size_t k = 1; k <= order; ++k){
+            power *= -inverse_z0;
+            c[k] = a[k] * power;
+        }
+
+        Complex sum = a[0] * log(-z0);
+        for(size_t k = 1; k <= order; ++k)
+            sum += c[k];
+        b[0] += sum;
+
+        Complex inverse_z0_l = 1.0;
+        for(size_t l = 1; l <= order; ++l){
+            inverse_z0_l *= inverse_z0;
+            Complex sum = -a[0] / (double) l;
+            for(size_t k = 1; k <= order; ++k)
+                sum += c[k] * binomials[l+k-1][k-1];
+            b[l] += sum * inverse_z0_l;
+        }
+    }
+
+    // evaluate the multipole expansion of `source` at the point of leaf `target`
+    void _multipole_to_point(size_t source, size_t target, double* forces, double* potentials){
+
+        const Complex* a = get_multipole(source);
+        Complex z = nodes[target].center - nodes[source].center;
+        Complex inverse_z = 1.0 / z;
+
+        Complex f = a[0] * log(z);
+        Complex df = a[0] * inverse_z;
+        Complex inverse_z_k = 1.0;
+        for(size_t k = 1; k <= order; ++k){
+            inverse_z_k *= inverse_z;
+            f += a[k] * inverse_z_k;
+            df -= (double) k * a[k] * inverse_z_k * inverse_z;
+        }
+
+        _add_to_point(target, f, df, forces, potentials);
+    }
+
+    // direct interaction of two leaves
+    void _point_to_point(size_t source, size_t target, double* forces, double* potentials){
+        Complex z = nodes[target].center - nodes[source].center;
+        if (norm(z) == 0)
+            return;
+        double m = nodes[source].tree->total_mass;
+        _add_to_point(target, m * log(z), m / z, forces, potentials);
+    }
+
+    // add the complex potential f and its derivative df to a leaf's point,
+    // the potential is Re f and the force is -grad Re f = (-Re df, Im df)
+    void _add_to_point(size_t leaf, const Complex &f, const Complex &df, double* forces, double* potentials){
+        size_t id = (size_t) nodes[leaf].tree->this_id;
+        forces[2*id] -= df.real();
+        forces[2*id+1] += df.imag();
+        if (potentials != NULL)
+            potentials[id] += f.real();
+    }
+
+    bool _are_well_separated(size_t a, size_t b){
+        double r = nodes[a].radius + nodes[b].radius;
+        return r*r < theta * theta * norm(nodes[a].center - nodes[b].center);
+    }
+
+    // dual-tree traversal that collects the interactions of all points in `target`
+    // with all points in `source`
+    void _interact(size_t target, size_t source, double* forces, double* potentials){
+
+        FMMNode &T = nodes[target];
+        FMMNode &S = nodes[source];
+
+        if (target == source){
+            if (T.is_leaf)
+                return;
+            for(size_t a = 0; a < T.number_of_children; ++a)
+                for(size_t b = 0; b < T.number_of_children; ++b)
+                    _interact(T.children[a], T.children[b], forces, potentials);
+            return;
+        }
+
+        if (_are_well_separated(target, source)){
+            if (T.is_leaf)
+                _multipole_to_point(source, target, forces, potentials);
+            else
+                _multipole_to_local(source, target);
+            return;
+        }
+
+        if (T.is_leaf && S.is_leaf){
+            _point_to_point(source, target, forces, potentials);
+            return;
+        }
+
+        // split the larger cell
+        if (S.is_leaf || (!T.is_leaf && T.radius > S.radius)){
+            for(size_t c = 0; c < T.number_of_children; ++c)
+                _interact(T.children[c], source, forces, potentials);
+        } else {
+            for(size_t c = 0; c < S.number_of_children; ++c)
+                _interact(target, S.children[c], forces, potentials);
+        }
+    }
+
+    // shift the local expansion of `parent` to the center of `child` (L2L)
+    void _local_to_local(size_t parent, size_t child){
+
+        const Complex* a = get_local(parent);
+        Complex* b = get_local(child);
+        Complex t = nodes[child].center - nodes[parent].center;
+
+        for(size_t l = 0; l <= order; ++l){
+            Complex sum = 0.0;
+            Complex t_kl = 1.0; // t^(k-l)
+            for(size_t k = l; k <= order; ++k){
+                sum += a[k] * binomials[k][l] * t_kl;
+                t_kl *= t;
+            }
+            b[l] += sum;
+        }
+    }
+
+    // pass local expansions down to the leaves and evaluate them there (L2P)
+    void _downward(size_t i, double* forces, double* potentials){
+
+        FMMNode &node = nodes[i];
+        const Complex* b = get_local(i);
+
+        if (node.is_leaf){
+            // a leaf's expansion is centered at its point
+            _add_to_point(i, b[0], b[1], forces, potentials);
+            return;
+        }
+
+        for(size_t c = 0; c < node.number_of_children; ++c){
+            _local_to_local(i, node.children[c]);
+            _downward(node.children[c], forces, potentials);
+        }
+    }
+
+  public:
+    size_t order = 10;     // number of terms of the expansions
+    double theta = 0.5;    // opening parameter of the well-separation criterion
+    size_t n_threads = 0;  // number of threads, 0 means all available cores
+
+    FastMultipoleMethod(size_t _order = 10,
+                        double _theta = 0.5,
+                        size_t _n_threads = 0
+                        )
+    {
+        order = _order;
+        theta = _theta;
+        n_threads = _n_threads;
+    }
+
+    // Compute forces (interleaved (x, y)-pairs) and potentials of all points
+    // in the tree. Results are indexed by the points' ids, which must not be
+    // negative, both vectors are resized to hold the largest id. Trees can
+    // hold fewer points than ids (e.g. points outside of a fixed root extent
+    // are dropped), the rows of missing ids are zero.
+    void compute(
+                 const QuadTree &tree,
+                 vector < double > &forces,
+                 vector < double > &potentials
+            )
+    {
+        if (order < 1)
+            throw invalid_argument("order must be at least 1");
+        if (!(theta > 0 && theta < 1))
+            throw invalid_argument("theta must lie in (0, 1)");
+        // the expansions would have to be summed over the images of all cells
+        if (tree.periodic)
+            throw logic_error("The Fast Multipole Method is not supported for periodic trees.");
+
+        forces.clear();
+        potentials.clear();
+
+        size_t N = tree.number_of_contained_points;
+        if (N == 0)
+            return;
+
+        binomials.assign(2*order+1, vector < double >(2*order+1, 0.0));
+        for(size_t n = 0; n <= 2*order; ++n){
+            binomials[n][0] = 1.0;
+            for(size_t k = 1; k <= n; ++k)
+                binomials[n][k] = binomials[n-1][k-1] + (k < n ? binomials[n-1][k] : 0.0);
+        }
+
+        {
+            TraceScope scope("fmm_setup");
+            nodes.clear();
+            _add_node(&tree);
+        }
+
+        size_t number_of_ids = 0;
+        vector < PointId > leaf_ids;
+        leaf_ids.reserve(N);
+        for(auto const &node: nodes){
+            if (!node.is_leaf)
+                continue;
+            if (node.tree->this_id < 0)
+                throw invalid_argument("point ids must not be negative");
+            leaf_ids.push_back(node.tree->this_id);
+            number_of_ids = max(number_of_ids, (size_t) node.tree->this_id + 1);
+        }
+        if (number_of_ids > max(_FMM_MAX_ROWS_PER_POINT * N, _FMM_MIN_ROWS))
+            throw length_error("The largest point id (" + to_string(number_of_ids - 1) + ") is too large for "
+                               + to_string(N) + " points, results are indexed by id. Renumber the points "
+                               "(e.g. insert them with first_id = 0).");
+
+        // the results of points with the same id would be summed up in one row
+        vector < bool > has_id(number_of_ids, false);
+        for(PointId id: leaf_ids){
+            if (has_id[id])
+                throw invalid_argument("The point id " + to_string(id) + " occurs more than once, "
+                                       "results are indexed by id.");
+            has_id[id] = true;
+        }
+        forces.assign(2*number_of_ids, 0.0);
+        potentials.assign(number_of_ids, 0.0);
+
+        multipoles.assign(nodes.size() * (order+1), 0.0);
+        locals.assign(nodes.size() * (order+1), 0.0);
+
+        n_threads = get_number_of_threads(n_threads);
+        _get_frontier(n_threads);
+
+        // upward pass, subtrees first, then the nodes above them
+        parallel_for(frontier.size(), n_threads, [&](size_t f, size_t){
+            _upward(frontier[f]);
+        }, "fmm_upward");
+        for(auto it = top_nodes.rbegin(); it != top_nodes.rend(); ++it)
+            for(size_t c = 0; c < nodes[*it].number_of_children; ++c)
+                _multipole_to_multipole(nodes[*it].children[c], *it);
+
+        // interactions, every thread only writes to its own target subtrees
+        parallel_for(frontier.size(), n_threads, [&](size_t f, size_t){
+            _interact(frontier[f], 0, forces.data(), potentials.data());
+        }, "fmm_interact");
+
+        // downward pass
+        parallel_for(frontier.size(), n_threads, [&](size_t f, size_t){
+            _downward(frontier[f], forces.data(), potentials.data());
+        }, "fmm_downward");
+    }
+};
+
+#endif /* FastMultipoleMethod_h */
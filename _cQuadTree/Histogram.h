@@ -0,0 +1,132 @@
+//
+//  Histogram.h
+//
+//  Weighted histograms of distance-count data.
+//
+
+#ifndef Histogram_h
+#define Histogram_h
+
+#include <Parallel.h>
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+const int _ARBITRARY_BINS = 0;
+const int _LINEAR_BINS = 1;
+const int _LOGARITHMIC_BINS = 2;
+
+// finds the bin a value falls into, for a sorted list of bin edges.
+// Uniformly and logarithmically spaced edges are detected on construction
+// and looked up in O(1), all other edges are looked up with a binary search.
+class HistogramBins
+{
+  private:
+    double first;   // the lowest edge (or its log for logarithmic bins)
+    double step;    // the bin width (or the log of the edge ratio for logarithmic bins)
+
+    // check whether the values have a constant difference
+    static bool is_uniform(const vector < double > &values){
+        double mean_step = (values.back() - values.front()) / (values.size() - 1);
+        if (!(mean_step > 0))
+            return false;
+        for(size_t i = 1; i < values.size(); ++i)
+            if (fabs((values[i] - values[i-1]) - mean_step) > 1e-9 * mean_step)
+                return false;
+        return true;
+    }
+
+  public:
+    vector < double > edges;
+    int spacing = _ARBITRARY_BINS;
+
+    HistogramBins(const vector < double > &_edges){
+
+        if (_edges.size() < 2)
+            throw invalid_argument("At least two bin edges are required.");
+
+        edges = _edges;
+        sort(edges.begin(), edges.end());
+
+        if (is_uniform(edges)){
+            spacing = _LINEAR_BINS;
+            first = edges.front();
+            step = (edges.back() - edges.front()) / number_of_bins();
+        } else if (edges.front() > 0) {
+            vector < double > log_edges;
+            for(auto const &edge: edges)
+                log_edges.push_back(log(edge));
+            if (is_uniform(log_edges)){
+                spacing = _LOGARITHMIC_BINS;
+                first = log_edges.front();
+                step = (log_edges.back() - log_edges.front()) / number_of_bins();
+            }
+        }
+    }
+
+    size_t number_of_bins() const {
+        return edges.size() - 1;
+    }
+
+    // Returns the index b of the bin with edges[b] < x <= edges[b+1]
+    // (the same convention as numpy.searchsorted(edges, x) - 1),
+    // or -1 if x lies outside of the bins.
+    long get_bin(const double &x) const {
+
+        if (!(x > edges.front() && x <= edges.back()))
+            return -1;
+
+        long last = (long) number_of_bins() - 1;
+        long b;
+        if (spacing == _LINEAR_BINS)
+            b = (long) ceil((x - first) / step) - 1;
+        else if (spacing == _LOGARITHMIC_BINS)
+            b = (long) ceil((log(x) - first) / step) - 1;
+        else
+            return (long) (lower_bound(edges.begin(), edges.end(), x) - edges.begin()) - 1;
+
+        // correct for round-off errors in the direct computation
+        b = max(0L, min(b, last));
+        while (b > 0 && x <= edges[b])
+            --b;
+        while (b < last && x > edges[b+1])
+            ++b;
+
+        return b;
+    }
+};
+
+// Sum up the `counts` of all `data` values per bin. Every thread
+// fills its own histogram, which are added up in the end.
+inline vector < int64_t > weighted_histogram(
+              const double* data,
+              const int64_t* counts,
+              size_t n,
+              const HistogramBins &bins,
+              size_t n_threads = 0
+            )
+{
+    size_t n_bins = bins.number_of_bins();
+    n_threads = get_number_of_threads(n_threads);
+
+    vector < vector < int64_t > > thread_histograms(n_threads, vector < int64_t >(n_bins, 0));
+
+    parallel_for(n, n_threads, [&](size_t i, size_t thread_id){
+        long b = bins.get_bin(data[i]);
+        if (b >= 0)
+            thread_histograms[thread_id][b] += counts[i];
+    }, "histogram");
+
+    vector < int64_t > histogram(n_bins, 0);
+    for(auto const &thread_histogram: thread_histograms)
+        for(size_t b = 0; b < n_bins; ++b)
+            histogram[b] += thread_histogram[b];
+
+    return histogram;
+}
+
+#endif /* Histogram_h */
@@ -0,0 +1,128 @@
+//
+//  Integrator.h
+//
+//  Time integration of point masses whose accelerations
+//  are evaluated with a Barnes-Hut tree.
+//
+
+#ifndef Integrator_h
+#define Integrator_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+// Advances positions and velocities with a velocity-Verlet
+// (kick-drift-kick leapfrog) scheme. In every step, the tree
+// is rebuilt from the current positions and the accelerations
+// of all points are evaluated in parallel.
+class Integrator
+{
+  public:
+
+    double dt = 0.01;                // time step
+    double theta = 0.5;              // Barnes-Hut cutoff parameter
+    double coupling = 1.0;           // acceleration = coupling * tree force, negative for repulsion
+    double damping = 0.0;            // velocities are multiplied by (1 - damping) after every step
+    double max_displacement = 0.0;   // maximum distance a point can move per step, 0 means unlimited
+    double cooling = 1.0;            // the maximum displacement is multiplied by this factor after every step
+                                     // of a call to `integrate` (`max_displacement` itself stays unchanged)
+    size_t n_threads = 0;            // number of threads, 0 means all available cores
+
+    Integrator(){
+    };
+
+    // evaluate the accelerations of all points, `positions` and
+    // `accelerations` contain interleaved (x, y)-pairs
+    void compute_accelerations(
+                 const double* positions,
+                 vector < double > &masses,
+                 size_t n,
+                 double* accelerations
+            )
+    {
+        vector < Point > _positions;
+        _positions.reserve(n);
+        for(size_t i = 0; i < n; ++i)
+            _positions.push_back(Point(positions[2*i], positions[2*i+1]));
+
+        QuadTree tree(_positions, masses);
+
+        vector < size_t > order = tree.get_query_order(_positions);
+
+        parallel_for(n, n_threads, [&](size_t k, size_t){
+            size_t i = order[k];
+            Point force;
+            tree.compute_force(_positions[i], force, theta);
+            accelerations[2*i] = coupling * force.x;
+            accelerations[2*i+1] = coupling * force.y;
+        }, "traverse");
+    }
+
+    // Advance `positions` and `velocities` (interleaved (x, y)-pairs, updated in place)
+    // by `n_steps` time steps. If given, `callback(step)` is called after every
+    // `callback_every` steps, the integration stops early if it returns false.
+    // Returns the number of steps that were taken.
+    size_t integrate(
+                 double* positions,
+                 double* velocities,
+                 vector < double > &masses,
+                 size_t n,
+                 size_t n_steps,
+                 const function < bool (size_t) > &callback = nullptr,
+                 size_t callback_every = 1
+            )
+    {
+        if (masses.size() != n)
+            throw length_error("masses and positions must be of equal length");
+        if (callback_every == 0)
+            throw invalid_argument("callback_every must be positive");
+
+        vector < double > accelerations(2*n);
+        compute_accelerations(positions, masses, n, accelerations.data());
+
+        // the cooled maximum displacement of the current step
+        double step_max_displacement = max_displacement;
+
+        for(size_t step = 1; step <= n_steps; ++step){
+
+            // half kick and drift
+            parallel_for(n, n_threads, [&](size_t i, size_t){
+                for(size_t k = 2*i; k < 2*i+2; ++k)
+                    velocities[k] += 0.5 * dt * accelerations[k];
+
+                Point displacement(dt * velocities[2*i], dt * velocities[2*i+1]);
+                double length = displacement.length();
+                if (step_max_displacement > 0 && length > step_max_displacement)
+                    displacement = displacement * (step_max_displacement / length);
+
+                positions[2*i] += displacement.x;
+                positions[2*i+1] += displacement.y;
+            }, "integrate");
+
+            compute_accelerations(positions, masses, n, accelerations.data());
+
+            // second half kick
+            parallel_for(n, n_threads, [&](size_t i, size_t){
+                for(size_t k = 2*i; k < 2*i+2; ++k){
+                    velocities[k] += 0.5 * dt * accelerations[k];
+                    velocities[k] *= (1.0 - damping);
+                }
+            }, "integrate");
+
+            step_max_displacement *= cooling;
+
+            if (callback && (step % callback_every == 0) && !callback(step))
+                return step;
+        }
+
+        return n_steps;
+    }
+};
+
+#endif /* Integrator_h */
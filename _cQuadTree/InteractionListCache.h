@@ -0,0 +1,121 @@
+//
+//  InteractionListCache.h
+//
+//  Reuse the nodes a Barnes-Hut force evaluation interacts with
+//  across repeated queries of (almost) the same points.
+//
+
+#ifndef InteractionListCache_h
+#define InteractionListCache_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <atomic>
+#include <cmath>
+
+using namespace std;
+
+// Caches the interaction list (leaves and accepted internal nodes)
+// of every query point. A list is reused as long as `theta` and the
+// topology of the tree did not change (e.g. when the tree was only refit
+// with `QuadTree::refit`) and the distance the query point moved from the
+// position the list was built for, plus the distance the tree's points
+// moved with `refit` since then, is at most `tolerance`. Otherwise,
+// only the lists that became invalid are rebuilt.
+class InteractionListCache
+{
+  private:
+    const QuadTree* tree = NULL;      // the tree the lists refer to
+    size_t topology_version = 0;      // the topology version of the tree when the lists were built
+    double list_theta = nan("");      // the `theta` the lists were built with
+    vector < vector < const QuadTree* > > interaction_lists;
+    vector < Point > anchors;         // the query positions the lists were built for
+    vector < double > anchor_displacements; // the tree's `refit_displacement` when the lists were built
+    vector < bool > is_valid;
+
+  public:
+    double theta = 0.5;               // Barnes-Hut cutoff parameter
+    double tolerance = 0.0;           // distance a query point can move before its list is rebuilt
+    size_t n_threads = 0;             // number of threads, 0 means all available cores
+    size_t number_of_rebuilt_lists = 0; // number of lists that were rebuilt in the last call
+
+    InteractionListCache(double _theta = 0.5,
+                         double _tolerance = 0.0,
+                         size_t _n_threads = 0
+                         )
+    {
+        theta = _theta;
+        tolerance = _tolerance;
+        n_threads = _n_threads;
+    }
+
+    // mark all lists as invalid
+    void invalidate(){
+        tree = NULL;
+        interaction_lists.clear();
+        anchors.clear();
+        anchor_displacements.clear();
+        is_valid.clear();
+    }
+
+    // compute the forces on all `positions`, the result contains
+    // interleaved (x, y)-pairs
+    void compute_forces(
+                 const QuadTree &_tree,
+                 const vector < Point > &positions,
+                 double* forces
+            )
+    {
+        size_t n = positions.size();
+
+        if (tree != &_tree
+            || topology_version != _tree.topology_version
+            || list_theta != theta
+            || n != interaction_lists.size()){
+            invalidate();
+            tree = &_tree;
+            topology_version = _tree.topology_version;
+            list_theta = theta;
+            interaction_lists.resize(n);
+            anchors.resize(n);
+            anchor_displacements.resize(n);
+            is_valid.assign(n, false);
+        }
+
+        atomic < size_t > rebuilt(0);
+
+        vector < size_t > order = _tree.get_query_order(positions);
+
+        parallel_for(n, n_threads, [&](size_t k, size_t){
+
+            size_t i = order[k];
+            const Point &pos = positions[i];
+
+            double tree_displacement = _tree.refit_displacement - anchor_displacements[i];
+            if (!is_valid[i] || (pos - anchors[i]).length() + tree_displacement > tolerance){
+                interaction_lists[i].clear();
+                _tree.get_interaction_list(pos, interaction_lists[i], theta);
+                anchors[i] = pos;
+                anchor_displacements[i] = _tree.refit_displacement;
+                ++rebuilt;
+            }
+
+            Point force;
+            for(auto const &node: interaction_lists[i]){
+                Point d = _tree.get_displacement(pos, node->is_leaf() ? node->this_pos : node->center_of_mass);
+                force += get_point_force(node->total_mass, d);
+            }
+
+            forces[2*i] = force.x;
+            forces[2*i+1] = force.y;
+        }, "traverse");
+
+        // vector < bool > packs bits, so it can't be written to from several threads
+        is_valid.assign(n, true);
+        number_of_rebuilt_lists = rebuilt;
+    }
+};
+
+#endif /* InteractionListCache_h */
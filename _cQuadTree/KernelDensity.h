@@ -0,0 +1,382 @@
+//
+//  KernelDensity.h
+//
+//  Tree-accelerated kernel density estimation at query points
+//  and on regular grids.
+//
+
+#ifndef KernelDensity_h
+#define KernelDensity_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+const int _GAUSSIAN_KERNEL = 0;
+const int _EPANECHNIKOV_KERNEL = 1;
+
+// number of grid points per side of the blocks that are
+// distributed among threads in `kernel_density_on_grid`
+const size_t _KDE_GRID_BLOCK_SIZE = 16;
+
+// a radially symmetric 2D kernel, normalized such that
+// it integrates to one over the plane
+class Kernel
+{
+  private:
+    double inverse_bandwidth2;
+    double normalization;
+
+  public:
+    int kernel;
+    double bandwidth;
+
+    Kernel(int _kernel, double _bandwidth){
+
+        if (!(_bandwidth > 0))
+            throw invalid_argument("bandwidth must be positive");
+
+        kernel = _kernel;
+        bandwidth = _bandwidth;
+        inverse_bandwidth2 = 1.0 / (bandwidth*bandwidth);
+        const double pi = acos(-1.0); // M_PI is not part of the standard
+
+        if (kernel == _GAUSSIAN_KERNEL)
+            normalization = inverse_bandwidth2 / (2*pi);
+        else if (kernel == _EPANECHNIKOV_KERNEL)
+            normalization = 2 * inverse_bandwidth2 / pi;
+        else
+            throw invalid_argument("Unknown kernel id " + to_string(kernel));
+    }
+
+    Kernel(const string &name, double _bandwidth)
+        : Kernel(get_kernel_id(name), _bandwidth)
+    {
+    }
+
+    static int get_kernel_id(const string &name){
+        if (name == "gaussian")
+            return _GAUSSIAN_KERNEL;
+        if (name == "epanechnikov")
+            return _EPANECHNIKOV_KERNEL;
+        throw invalid_argument("Unknown kernel '" + name + "', use 'gaussian' or 'epanechnikov'");
+    }
+
+    // evaluate the kernel at squared distance `r2`
+    // (monotonically decreasing in `r2`)
+    double operator()(double r2) const {
+        double u2 = r2 * inverse_bandwidth2;
+        if (kernel == _GAUSSIAN_KERNEL)
+            return normalization * exp(-0.5*u2);
+        return u2 < 1.0 ? normalization * (1.0 - u2) : 0.0;
+    }
+
+    // upper bound of the spectral norm of the kernel's Hessian
+    // for all squared distances in [min2, max2]
+    double get_hessian_bound(double min2, double max2) const {
+        if (kernel == _GAUSSIAN_KERNEL)
+            return (*this)(min2) * inverse_bandwidth2 * max(1.0, max2 * inverse_bandwidth2);
+        // the Epanechnikov kernel is quadratic within its support, but has a kink at its edge
+        if (max2 * inverse_bandwidth2 < 1.0)
+            return 2 * normalization * inverse_bandwidth2;
+        return INFINITY;
+    }
+};
+
+// squared minimum and maximum distance between the points
+// of a query box and the points of a node
+inline void get_distance2_bounds(const Extent &box, const QuadTree* node, double &min2, double &max2){
+    if (node->is_leaf()){
+        min2 = box.get_min_distance2_to(node->this_pos);
+        max2 = box.get_max_distance2_to(node->this_pos);
+    } else {
+        Extent bounds = node->get_point_bounds();
+        min2 = box.get_min_distance2_to(bounds);
+        max2 = box.get_max_distance2_to(bounds);
+    }
+}
+
+// A frontier node of a kernel sum traversal and the lower bound of
+// its kernel value over all points of the query box.
+typedef pair < const QuadTree*, double > KernelSumNode;
+
+// Refine the kernel sum sum_i m_i K(|x - x_i|) that applies to every point x
+// of the query box `box` (a single point or a tile of grid points), starting
+// from the subtrees in `nodes`.
+//
+// Every point of the box lies within the minimum and maximum distance of a
+// node, which bounds the node's kernel values by K_min and K_max. Approximating
+// the node's contribution by the midpoint M (K_max + K_min)/2 makes an error of
+// at most M (K_max - K_min)/2. This is accepted if it is within the node's share
+// of the error budget, M/M_total * (atol M_total + rtol L), where L is a lower
+// bound of the kernel sum (the sum of M K_min over all nodes of the current
+// frontier, which only grows as nodes are opened). The total error of the
+// density (the kernel sum divided by M_total) is then at most `atol + rtol * density`.
+//
+// Nodes that can't be approximated are opened if they are larger than the box
+// (nearest subtrees first, such that L grows quickly) and appended to `open_nodes`
+// otherwise, to be refined for smaller boxes. On return, `sum` and `lower` contain
+// the approximated contributions and their lower bound.
+inline void _refine_kernel_sum(
+              const Extent &box,
+              const vector < const QuadTree* > &nodes,
+              double &sum,
+              double &lower,
+              vector < const QuadTree* > &open_nodes,
+              const Kernel &kernel,
+              double atol,
+              double rtol,
+              double total_mass
+            )
+{
+    double box_size = max(box.width(), box.height());
+    double open_lower = 0.0;
+
+    double min2, max2;
+
+    vector < KernelSumNode > stack;
+    for(auto it = nodes.rbegin(); it != nodes.rend(); ++it){
+        get_distance2_bounds(box, *it, min2, max2);
+        double K_min = kernel(max2);
+        lower += (*it)->total_mass * K_min;
+        stack.push_back(make_pair(*it, K_min));
+    }
+
+    vector < KernelSumNode > children;
+
+    while (!stack.empty()){
+
+        const QuadTree* node = stack.back().first;
+        double K_min = stack.back().second;
+        double M = node->total_mass;
+        stack.pop_back();
+
+        if (node->is_empty())
+            continue;
+
+        get_distance2_bounds(box, node, min2, max2);
+        double K_max = min2 < max2 ? kernel(min2) : K_min;
+
+        double tolerance = atol + rtol * lower / total_mass;
+
+        if (K_max - K_min <= 2 * tolerance){
+            sum += 0.5 * M * (K_max + K_min);
+        }
+        // For a single query point, the node can be approximated by its center of
+        // mass c instead. The first-order terms of the expansion of K around c cancel,
+        // the error is at most 1/2 M diag^2 |Hessian|, with diag the node's diagonal.
+        else if (box_size == 0 && !node->is_leaf() &&
+                 0.5 * node->get_point_bounds().get_vec().length2() * kernel.get_hessian_bound(min2, max2) <= tolerance){
+            sum += M * kernel((node->center_of_mass - box.get_bottom_left()).length2());
+        }
+        else if (!node->is_leaf() && max(node->geom.width(), node->geom.height()) + 2 * node->box_slack > box_size){
+            lower -= M * K_min;
+            children.clear();
+            node->_refine_if_lazy();
+            for(auto &subtree: node->subtrees.trees){
+                const QuadTree* _subtree = subtree;
+                if (_subtree == NULL)
+                    continue;
+                get_distance2_bounds(box, _subtree, min2, max2);
+                double child_K_min = kernel(max2);
+                lower += _subtree->total_mass * child_K_min;
+                children.push_back(make_pair(_subtree, child_K_min));
+            }
+            // the child with the largest lower bound ends up on top of the stack
+            sort(children.begin(), children.end(),
+                 [](const KernelSumNode &a, const KernelSumNode &b){ return a.second < b.second; });
+            stack.insert(stack.end(), children.begin(), children.end());
+        }
+        else {
+            open_lower += M * K_min;
+            open_nodes.push_back(node);
+        }
+    }
+
+    // open nodes are accounted for when they're refined
+    lower -= open_lower;
+}
+
+// The node bounds of the kernel sums don't account for the images of points in periodic trees.
+inline void _check_kernel_density_tree(const QuadTree &tree){
+    if (tree.periodic)
+        throw logic_error("Kernel density estimation is not supported for periodic trees.");
+}
+
+// Sum of m_i K(|pos - x_i|) over all points in the tree, see `_refine_kernel_sum`.
+inline double get_kernel_sum(
+              const QuadTree &tree,
+              const Point &pos,
+              const Kernel &kernel,
+              double atol,
+              double rtol
+            )
+{
+    _check_kernel_density_tree(tree);
+    if (tree.total_mass <= 0)
+        return 0.0;
+
+    // for a single point, leaves are evaluated exactly and
+    // internal nodes are always larger, hence no node stays open
+    double sum = 0.0;
+    double lower = 0.0;
+    vector < const QuadTree* > open_nodes;
+    _refine_kernel_sum(Extent(pos, pos), { &tree }, sum, lower, open_nodes,
+                       kernel, atol, rtol, tree.total_mass);
+    return sum;
+}
+
+// Estimate the density at every query point as the kernel sum divided by the
+// total mass of the tree. The error of every estimate is at most `atol + rtol * density`.
+inline void kernel_density(
+              const QuadTree &tree,
+              const vector < Point > &positions,
+              double* density,
+              const Kernel &kernel,
+              double atol = 0.0,
+              double rtol = 1e-2,
+              size_t n_threads = 0
+            )
+{
+    _check_kernel_density_tree(tree);
+    double normalization = tree.total_mass > 0 ? 1.0 / tree.total_mass : 0.0;
+    vector < size_t > order = tree.get_query_order(positions);
+
+    parallel_for(positions.size(), n_threads, [&](size_t k, size_t){
+        size_t i = order[k];
+        density[i] = normalization * get_kernel_sum(tree, positions[i], kernel, atol, rtol);
+    }, "traverse");
+}
+
+// the points of a regular grid, grid point (ix, iy)
+// lies at the center of cell (ix, iy) of `geom`
+class KernelDensityGrid
+{
+  public:
+    Extent geom;
+    size_t nx;
+    size_t ny;
+
+    KernelDensityGrid(const Extent &_geom, size_t _nx, size_t _ny){
+        geom = _geom;
+        nx = _nx;
+        ny = _ny;
+    }
+
+    Point get_point(size_t ix, size_t iy) const {
+        return Point(geom.left() + (ix + 0.5) * geom.width() / nx,
+                     geom.bottom() + (iy + 0.5) * geom.height() / ny);
+    }
+
+    // the box spanned by the grid points with indices [ix0, ix1) x [iy0, iy1)
+    Extent get_tile(size_t ix0, size_t ix1, size_t iy0, size_t iy1) const {
+        return Extent(get_point(ix0, iy0), get_point(ix1-1, iy1-1));
+    }
+};
+
+// Evaluate the kernel sums of all grid points of the tile [ix0, ix1) x [iy0, iy1),
+// given the nodes that stayed open for the enclosing tile, and the approximated
+// contributions that apply to all points of the tile (`offset`, with lower bound
+// `lower_offset`). Nodes that can be approximated for the whole tile are evaluated
+// once for all of its points, the others are passed on to the four sub-tiles,
+// such that neighboring grid points share most of the traversal.
+inline void _kernel_sum_on_tile(
+              const KernelDensityGrid &grid,
+              size_t ix0, size_t ix1,
+              size_t iy0, size_t iy1,
+              const vector < const QuadTree* > &nodes,
+              double offset,
+              double lower_offset,
+              double* sums,
+              const Kernel &kernel,
+              double atol,
+              double rtol,
+              double total_mass
+            )
+{
+    double sum = offset;
+    double lower = lower_offset;
+    vector < const QuadTree* > open_nodes;
+    _refine_kernel_sum(grid.get_tile(ix0, ix1, iy0, iy1), nodes, sum, lower, open_nodes,
+                       kernel, atol, rtol, total_mass);
+
+    if (open_nodes.empty()){
+        for(size_t iy = iy0; iy < iy1; ++iy)
+            for(size_t ix = ix0; ix < ix1; ++ix)
+                sums[iy * grid.nx + ix] = sum;
+        return;
+    }
+
+    // split the tile in halves along both index dimensions (if possible)
+    size_t ix_mid = ix1 - ix0 > 1 ? (ix0 + ix1) / 2 : ix1;
+    size_t iy_mid = iy1 - iy0 > 1 ? (iy0 + iy1) / 2 : iy1;
+
+    size_t x_ranges[2][2] = {{ix0, ix_mid}, {ix_mid, ix1}};
+    size_t y_ranges[2][2] = {{iy0, iy_mid}, {iy_mid, iy1}};
+
+    for(auto const &x_range: x_ranges)
+        for(auto const &y_range: y_ranges)
+            if (x_range[0] < x_range[1] && y_range[0] < y_range[1])
+                _kernel_sum_on_tile(grid,
+                                    x_range[0], x_range[1],
+                                    y_range[0], y_range[1],
+                                    open_nodes, sum, lower, sums,
+                                    kernel, atol, rtol, total_mass);
+}
+
+// Estimate the density on a regular grid of nx x ny points that lie at the
+// cell centers of `geom`. The result is stored row by row, i.e. the density
+// of grid point (ix, iy) is `density[iy*nx + ix]`. Blocks of neighboring grid
+// points are traversed together with the tree (see `_kernel_sum_on_tile`),
+// blocks are evaluated in parallel. The error of every estimate is at most
+// `atol + rtol * density`.
+inline void kernel_density_on_grid(
+              const QuadTree &tree,
+              const Extent &geom,
+              size_t nx,
+              size_t ny,
+              double* density,
+              const Kernel &kernel,
+              double atol = 0.0,
+              double rtol = 1e-2,
+              size_t n_threads = 0
+            )
+{
+    if (nx == 0 || ny == 0)
+        throw invalid_argument("nx and ny must be positive");
+    _check_kernel_density_tree(tree);
+
+    KernelDensityGrid grid(geom, nx, ny);
+    size_t bx = (nx + _KDE_GRID_BLOCK_SIZE - 1) / _KDE_GRID_BLOCK_SIZE;
+    size_t by = (ny + _KDE_GRID_BLOCK_SIZE - 1) / _KDE_GRID_BLOCK_SIZE;
+
+    double mass = tree.total_mass;
+    if (!(mass > 0)){
+        fill(density, density + nx*ny, 0.0);
+        return;
+    }
+
+    vector < const QuadTree* > root = { &tree };
+
+    parallel_for(bx * by, n_threads, [&](size_t block, size_t){
+        size_t ix0 = (block % bx) * _KDE_GRID_BLOCK_SIZE;
+        size_t iy0 = (block / bx) * _KDE_GRID_BLOCK_SIZE;
+        _kernel_sum_on_tile(grid,
+                            ix0, min(ix0 + _KDE_GRID_BLOCK_SIZE, nx),
+                            iy0, min(iy0 + _KDE_GRID_BLOCK_SIZE, ny),
+                            root, 0.0, 0.0, density,
+                            kernel, atol, rtol, mass);
+    }, "traverse");
+
+    for(size_t i = 0; i < nx*ny; ++i)
+        density[i] /= mass;
+}
+
+#endif /* KernelDensity_h */
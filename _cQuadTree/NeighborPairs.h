@@ -0,0 +1,340 @@
+//
+//  NeighborPairs.h
+//
+//  All pairs of points that lie within a fixed radius of each
+//  other, found with a dual-tree search over pairs of nodes.
+//
+
+#ifndef NeighborPairs_h
+#define NeighborPairs_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+// the distance between the intervals [a_low, a_high] and [b_low, b_high]
+// (zero if they overlap)
+inline double _get_interval_gap(double a_low, double a_high, double b_low, double b_high){
+    return max(max(a_low - b_high, b_low - a_high), 0.0);
+}
+
+// the distance between the intervals [a_low, a_high] and [b_low + k period, b_high + k period]
+// for the integer k that brings them closest, i.e. the distance of their centers
+// reduced to [-period/2, period/2], minus their half widths
+inline double _get_periodic_interval_gap(double a_low, double a_high, double b_low, double b_high, double period){
+    double d = 0.5 * ((b_low + b_high) - (a_low + a_high));
+    d -= period * round(d / period);
+    return max(fabs(d) - 0.5 * ((a_high - a_low) + (b_high - b_low)), 0.0);
+}
+
+// returns the squared minimum distance between any two points of the boxes
+// `a` and `b`, where, in periodic trees, `b` may be replaced by any of its images
+inline double get_min_distance2_between(const QuadTree &tree, const Extent &a, const Extent &b){
+
+    double dx, dy;
+    if (tree.periodic){
+        dx = _get_periodic_interval_gap(a.left(), a.right(), b.left(), b.right(), tree.period.x);
+        dy = _get_periodic_interval_gap(a.bottom(), a.top(), b.bottom(), b.top(), tree.period.y);
+    } else {
+        dx = _get_interval_gap(a.left(), a.right(), b.left(), b.right());
+        dy = _get_interval_gap(a.bottom(), a.top(), b.bottom(), b.top());
+    }
+
+    return dx*dx + dy*dy;
+}
+
+// append all leaves below `node` to `leaves`
+inline void get_leaves(const QuadTree* node, vector < const QuadTree* > &leaves){
+    if (node->is_leaf()){
+        leaves.push_back(node);
+        return;
+    }
+    node->_refine_if_lazy();
+    for(auto &subtree: node->subtrees.trees)
+        if (subtree != NULL)
+            get_leaves(subtree, leaves);
+}
+
+// Collects the pairs (i, j, distance) with i < j that one thread finds.
+class NeighborPairCollector
+{
+  public:
+    const QuadTree &tree;
+    vector < PointId > pairs;
+    vector < double > distances;
+
+    NeighborPairCollector(const QuadTree &_tree)
+        : tree(_tree)
+    {
+    }
+
+    void add_pair(const QuadTree* a, const QuadTree* b, double distance2){
+        pairs.push_back(min(a->this_id, b->this_id));
+        pairs.push_back(max(a->this_id, b->this_id));
+        distances.push_back(sqrt(distance2));
+    }
+
+    void add_pair(const QuadTree* a, const QuadTree* b){
+        add_pair(a, b, tree.get_displacement(a->this_pos, b->this_pos).length2());
+    }
+
+    // all points of `a` lie within the radius of all points of `b`
+    void add_all(const QuadTree* a, const QuadTree* b){
+        vector < const QuadTree* > leaves_a, leaves_b;
+        get_leaves(a, leaves_a);
+        get_leaves(b, leaves_b);
+        for(auto leaf_a: leaves_a)
+            for(auto leaf_b: leaves_b)
+                add_pair(leaf_a, leaf_b);
+    }
+
+    // all points of `a` lie within the radius of each other
+    void add_all_within(const QuadTree* a){
+        vector < const QuadTree* > leaves;
+        get_leaves(a, leaves);
+        for(size_t i = 0; i < leaves.size(); ++i)
+            for(size_t j = i + 1; j < leaves.size(); ++j)
+                add_pair(leaves[i], leaves[j]);
+    }
+};
+
+// Counts the pairs that one thread finds, without looking
+// at the points of nodes that are accepted as a whole.
+class NeighborPairCounter
+{
+  public:
+    size_t count = 0;
+
+    void add_pair(const QuadTree*, const QuadTree*, double){
+        count += 1;
+    }
+
+    void add_all(const QuadTree* a, const QuadTree* b){
+        count += a->number_of_contained_points * b->number_of_contained_points;
+    }
+
+    void add_all_within(const QuadTree* a){
+        size_t n = a->number_of_contained_points;
+        count += n * (n - 1) / 2;
+    }
+};
+
+// Report all pairs of points with a distance of at most sqrt(radius2),
+// where one point lies below node `a` and the other one below node `b`,
+// to `visitor`. Node pairs whose boxes are farther apart than the radius
+// are skipped, node pairs whose boxes lie within the radius as a whole
+// are reported without looking at single distances. Otherwise, the
+// larger node is opened.
+template < typename Visitor >
+void find_neighbor_pairs(
+              const QuadTree &tree,
+              const QuadTree* a,
+              const QuadTree* b,
+              double radius2,
+              Visitor &visitor
+        )
+{
+    if (a->is_empty() || b->is_empty())
+        return;
+
+    if (a->is_leaf() && b->is_leaf()){
+        double distance2 = tree.get_displacement(a->this_pos, b->this_pos).length2();
+        if (distance2 <= radius2)
+            visitor.add_pair(a, b, distance2);
+        return;
+    }
+
+    // after `refit`, points can lie outside of their node's box
+    Extent bounds_a = a->get_point_bounds();
+    Extent bounds_b = b->get_point_bounds();
+
+    if (get_min_distance2_between(tree, bounds_a, bounds_b) > radius2)
+        return;
+
+    // in periodic trees, the closest image of a point is never farther
+    // away than the point itself, so this also holds for all images
+    if (bounds_a.get_max_distance2_to(bounds_b) <= radius2){
+        visitor.add_all(a, b);
+        return;
+    }
+
+    if (b->is_leaf() || (!a->is_leaf() && a->geom.width() * a->geom.height() >= b->geom.width() * b->geom.height())){
+        a->_refine_if_lazy();
+        for(auto &subtree: a->subtrees.trees)
+            if (subtree != NULL)
+                find_neighbor_pairs(tree, subtree, b, radius2, visitor);
+    } else {
+        b->_refine_if_lazy();
+        for(auto &subtree: b->subtrees.trees)
+            if (subtree != NULL)
+                find_neighbor_pairs(tree, a, subtree, radius2, visitor);
+    }
+}
+
+// Report all pairs of points below node `a` with a distance
+// of at most sqrt(radius2) to `visitor`, each pair once.
+template < typename Visitor >
+void find_neighbor_pairs(
+              const QuadTree &tree,
+              const QuadTree* a,
+              double radius2,
+              Visitor &visitor
+        )
+{
+    if (!a->is_internal_node())
+        return;
+
+    Extent bounds = a->get_point_bounds();
+    if (bounds.get_max_distance2_to(bounds) <= radius2){
+        visitor.add_all_within(a);
+        return;
+    }
+
+    a->_refine_if_lazy();
+    for(int i = 0; i < 4; ++i){
+        const QuadTree* subtree = a->subtrees.trees[i];
+        if (subtree == NULL)
+            continue;
+        find_neighbor_pairs(tree, subtree, radius2, visitor);
+        for(int j = i + 1; j < 4; ++j)
+            if (a->subtrees.trees[j] != NULL)
+                find_neighbor_pairs(tree, subtree, a->subtrees.trees[j], radius2, visitor);
+    }
+}
+
+// Splits the tree into disjoint subtrees (at least `8 n_threads` of them,
+// unless the tree runs out of internal nodes) and returns the tasks of
+// a parallel neighbor search: every subtree with itself and every pair
+// of subtrees. Pairs that are too far apart are discarded right away.
+inline vector < pair < const QuadTree*, const QuadTree* > > get_neighbor_pair_tasks(
+              const QuadTree &tree,
+              double radius2,
+              size_t n_threads
+        )
+{
+    vector < const QuadTree* > frontier(1, &tree);
+
+    while (frontier.size() < 8 * n_threads){
+        vector < const QuadTree* > next;
+        bool split = false;
+        for(auto node: frontier){
+            if (!node->is_internal_node()){
+                next.push_back(node);
+                continue;
+            }
+            split = true;
+            node->_refine_if_lazy();
+            for(auto &subtree: node->subtrees.trees)
+                if (subtree != NULL)
+                    next.push_back(subtree);
+        }
+        frontier.swap(next);
+        if (!split)
+            break;
+    }
+
+    vector < pair < const QuadTree*, const QuadTree* > > tasks;
+    for(size_t i = 0; i < frontier.size(); ++i){
+        if (frontier[i]->is_empty())
+            continue;
+        tasks.push_back(make_pair(frontier[i], frontier[i]));
+        for(size_t j = i + 1; j < frontier.size(); ++j)
+            if (!frontier[j]->is_empty() &&
+                get_min_distance2_between(tree, frontier[i]->get_point_bounds(),
+                                          frontier[j]->get_point_bounds()) <= radius2)
+                tasks.push_back(make_pair(frontier[i], frontier[j]));
+    }
+    return tasks;
+}
+
+template < typename Visitor >
+void _run_neighbor_pair_task(
+              const QuadTree &tree,
+              const pair < const QuadTree*, const QuadTree* > &task,
+              double radius2,
+              Visitor &visitor
+        )
+{
+    if (task.first == task.second)
+        find_neighbor_pairs(tree, task.first, radius2, visitor);
+    else
+        find_neighbor_pairs(tree, task.first, task.second, radius2, visitor);
+}
+
+inline void _check_neighbor_radius(double radius){
+    if (!(radius >= 0))
+        throw invalid_argument("radius must be non-negative");
+}
+
+// Find all pairs of points in the tree with a distance of at most `radius`,
+// using `n_threads` threads (0 for all cores). Writes the point ids of
+// every pair to `pairs` as consecutive entries (i, j) with i < j, and
+// their distances to `distances`. The order of the pairs depends
+// on the number of threads.
+inline void get_neighbor_pairs(
+              const QuadTree &tree,
+              double radius,
+              vector < PointId > &pairs,
+              vector < double > &distances,
+              size_t n_threads = 0
+        )
+{
+    _check_neighbor_radius(radius);
+    n_threads = get_number_of_threads(n_threads);
+    double radius2 = radius * radius;
+
+    auto tasks = get_neighbor_pair_tasks(tree, radius2, n_threads);
+
+    vector < NeighborPairCollector > collectors(n_threads, NeighborPairCollector(tree));
+    parallel_for(tasks.size(), n_threads, [&](size_t i, size_t tid){
+        _run_neighbor_pair_task(tree, tasks[i], radius2, collectors[tid]);
+    }, "traverse");
+
+    // copy the pairs of all threads to one compact array
+    vector < size_t > offsets(n_threads + 1, 0);
+    for(size_t tid = 0; tid < n_threads; ++tid)
+        offsets[tid+1] = offsets[tid] + collectors[tid].distances.size();
+
+    pairs.resize(2 * offsets[n_threads]);
+    distances.resize(offsets[n_threads]);
+    parallel_for(n_threads, n_threads, [&](size_t tid, size_t){
+        NeighborPairCollector &collector = collectors[tid];
+        copy(collector.pairs.begin(), collector.pairs.end(), pairs.begin() + 2 * offsets[tid]);
+        copy(collector.distances.begin(), collector.distances.end(), distances.begin() + offsets[tid]);
+        vector < PointId >().swap(collector.pairs);
+        vector < double >().swap(collector.distances);
+    }, "materialize");
+}
+
+// Count the pairs of points in the tree with a distance
+// of at most `radius`, using `n_threads` threads (0 for all cores).
+inline size_t count_neighbor_pairs(
+              const QuadTree &tree,
+              double radius,
+              size_t n_threads = 0
+        )
+{
+    _check_neighbor_radius(radius);
+    n_threads = get_number_of_threads(n_threads);
+    double radius2 = radius * radius;
+
+    auto tasks = get_neighbor_pair_tasks(tree, radius2, n_threads);
+
+    vector < NeighborPairCounter > counters(n_threads);
+    parallel_for(tasks.size(), n_threads, [&](size_t i, size_t tid){
+        _run_neighbor_pair_task(tree, tasks[i], radius2, counters[tid]);
+    }, "traverse");
+
+    size_t count = 0;
+    for(auto const &counter: counters)
+        count += counter.count;
+    return count;
+}
+
+#endif /* NeighborPairs_h */
@@ -0,0 +1,72 @@
+//
+//  Parallel.h
+//
+//  Minimal helpers to distribute independent work items over threads.
+//
+
+#ifndef Parallel_h
+#define Parallel_h
+
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <Trace.h>
+
+using namespace std;
+
+// return the number of threads to use, where
+// `n_threads = 0` means "use all available cores"
+inline size_t get_number_of_threads(size_t n_threads = 0){
+    if (n_threads == 0)
+        n_threads = thread::hardware_concurrency();
+    if (n_threads == 0)
+        n_threads = 1;
+    return n_threads;
+}
+
+// call `func(i, thread_id)` for every i in [0, n). Each thread
+// works on one contiguous block of indices, such that consecutive
+// work items (e.g. query points that are close in space) are
+// processed by the same thread. The first exception that is
+// thrown in any of the threads is rethrown in the calling thread.
+// If `trace_name` is given, every thread's block is traced as a
+// span of this phase (see Trace.h).
+template < typename Function >
+void parallel_for(size_t n, size_t n_threads, Function func, const char* trace_name = NULL){
+
+    n_threads = min(get_number_of_threads(n_threads), max(n, (size_t) 1));
+
+    if (n_threads == 1){
+        TraceScope scope(trace_name);
+        for(size_t i = 0; i < n; ++i)
+            func(i, (size_t) 0);
+        return;
+    }
+
+    vector < thread > threads;
+    vector < exception_ptr > errors(n_threads);
+    size_t block_size = (n + n_threads - 1) / n_threads;
+
+    for(size_t t = 0; t < n_threads; ++t){
+        threads.push_back(thread([&, t](){
+            try {
+                TraceScope scope(trace_name);
+                size_t end = min(n, (t+1)*block_size);
+                for(size_t i = t*block_size; i < end; ++i)
+                    func(i, t);
+            } catch (...) {
+                errors[t] = current_exception();
+            }
+        }));
+    }
+
+    for(auto &worker: threads)
+        worker.join();
+
+    for(auto &error: errors)
+        if (error)
+            rethrow_exception(error);
+}
+
+#endif /* Parallel_h */
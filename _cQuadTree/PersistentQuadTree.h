@@ -0,0 +1,381 @@
+//
+//  PersistentQuadTree.h
+//
+//  A quad tree with immutable nodes. Inserting a point copies only
+//  the nodes on the path from the root to the point (path copying),
+//  all other nodes are shared between the old and the new version.
+//  Readers hold a snapshot of a version that never changes, such that
+//  queries never block and never wait for writers.
+//
+
+#ifndef PersistentQuadTree_h
+#define PersistentQuadTree_h
+
+#include <Point.h>
+#include <QuadTree.h>
+#include <Parallel.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+class PersistentNode;
+
+typedef shared_ptr < const PersistentNode > PersistentNodePointer;
+
+// a node of a persistent tree, nodes are never changed
+// after they were published as part of a version. A leaf
+// holds one point, or several points at the same position.
+class PersistentNode
+{
+  public:
+    Extent geom;                                // the box this node covers
+    Point this_pos = Point(nan(""), nan(""));   // position of the point (leaves only)
+    PointId this_id = -1;                       // data index of the point (leaves only)
+    double total_mass = 0.0;
+    Point total_mass_position = Point(0.f, 0.f);
+    Point center_of_mass = Point(0.f, 0.f);
+    size_t number_of_contained_points = 0;
+    PersistentNodePointer subtrees[4];
+
+    PersistentNode(const Extent &_geom){
+        geom = _geom;
+    }
+
+    bool is_leaf() const {
+        return !this_pos.is_null();
+    }
+
+    void _update_data(const Point &pos, double mass){
+        total_mass_position += mass * pos;
+        total_mass += mass;
+        center_of_mass = total_mass_position/total_mass;
+        number_of_contained_points++;
+    }
+};
+
+// The quadrant of `geom` a point belongs to. Points that fail the box test
+// of `geom` only because of rounding (on the boundary of a quadrant that
+// was split off a larger box) are put into the closest quadrant.
+// Returns -1 for positions that aren't finite.
+inline int get_persistent_quadrant(const Extent &geom, const Point &pos){
+    Point _pos(min(max(pos.x, geom.left()), geom.right()),
+               min(max(pos.y, geom.bottom()), geom.top()));
+    return geom.quad_to_insert_to(_pos);
+}
+
+// Returns a new version of the subtree `node` (which covers `geom`, and
+// might be NULL for an empty quadrant) that additionally contains the
+// given point. Only nodes on the path to the point are copied. Points
+// without a quadrant are dropped (`node` is returned unchanged).
+inline PersistentNodePointer insert_persistent(
+                 const PersistentNodePointer &node,
+                 const Extent &geom,
+                 const Point &pos,
+                 double mass,
+                 PointId id
+            )
+{
+    // empty quadrant, create a new leaf
+    if (node == NULL){
+        shared_ptr < PersistentNode > leaf = make_shared < PersistentNode >(geom);
+        leaf->this_pos = pos;
+        leaf->this_id = id;
+        leaf->_update_data(pos, mass);
+        return leaf;
+    }
+
+    // leaf, split it up into an internal node that contains both points
+    if (node->is_leaf()){
+        int quad = get_persistent_quadrant(geom, node->this_pos);
+        if (quad < 0 || get_persistent_quadrant(geom, pos) < 0)
+            return node;
+
+        // points at the same position (or in a box too small to be halved)
+        // can't be separated, the leaf then stands for all of them and keeps
+        // the position and id of its first point
+        Extent cell = geom.get_quadrant(quad);
+        if ((pos.x == node->this_pos.x && pos.y == node->this_pos.y) ||
+            !(cell.width() < geom.width() && cell.height() < geom.height())){
+            shared_ptr < PersistentNode > new_leaf = make_shared < PersistentNode >(*node);
+            new_leaf->_update_data(pos, mass);
+            return new_leaf;
+        }
+
+        shared_ptr < PersistentNode > leaf = make_shared < PersistentNode >(*node);
+        leaf->geom = cell;
+        shared_ptr < PersistentNode > new_node = make_shared < PersistentNode >(geom);
+        new_node->subtrees[quad] = leaf;
+        new_node->total_mass = node->total_mass;
+        new_node->total_mass_position = node->total_mass_position;
+        new_node->center_of_mass = node->center_of_mass;
+        new_node->number_of_contained_points = node->number_of_contained_points;
+
+        return insert_persistent(new_node, geom, pos, mass, id);
+    }
+
+    // internal node, copy it and replace the quadrant the point lies in
+    int quad = get_persistent_quadrant(geom, pos);
+    if (quad < 0)
+        return node;
+    shared_ptr < PersistentNode > new_node = make_shared < PersistentNode >(*node);
+    new_node->subtrees[quad] = insert_persistent(node->subtrees[quad],
+                                                 geom.get_quadrant(quad),
+                                                 pos,
+                                                 mass,
+                                                 id);
+    new_node->_update_data(pos, mass);
+
+    return new_node;
+}
+
+// A read-only handle of one version of a persistent tree. Copying
+// a snapshot is cheap and the version it refers to stays alive as
+// long as the snapshot does. All queries are safe to be called
+// from several threads at the same time.
+class QuadTreeSnapshot
+{
+  public:
+    PersistentNodePointer root;
+    Extent geom;        // the root extent of this version
+    size_t version = 0; // number of insertions that led to this version
+
+    QuadTreeSnapshot(){
+    }
+
+    QuadTreeSnapshot(const PersistentNodePointer &_root,
+                     const Extent &_geom,
+                     size_t _version)
+    {
+        root = _root;
+        geom = _geom;
+        version = _version;
+    }
+
+    size_t number_of_contained_points() const {
+        return root == NULL ? 0 : root->number_of_contained_points;
+    }
+
+    double total_mass() const {
+        return root == NULL ? 0.0 : root->total_mass;
+    }
+
+    // persistent trees aren't periodic and are never refitted
+    Point get_displacement(const Point &from, const Point &to) const {
+        return to - from;
+    }
+
+    // see `QuadTree::accepts`
+    bool accepts(const PersistentNode* node, const Point &d, double theta) const {
+        return is_within_opening_angle(node->geom, d, theta);
+    }
+
+    // call `f` with every subtree of `node`
+    template < typename Function >
+    void for_each_subtree(const PersistentNode* node, Function f) const {
+        for(auto const &subtree: node->subtrees)
+            if (subtree != NULL)
+                f(subtree.get());
+    }
+
+    // see `QuadTree::compute_force`
+    void compute_force(
+                 const Point &pos,
+                 Point &force,
+                 double theta = 0.5,
+                 const PersistentNode* node = NULL
+            ) const
+    {
+        if (node == NULL){
+            if (root == NULL)
+                return;
+            node = root.get();
+        }
+
+        accumulate_force(*this, node, pos, force, theta);
+    }
+
+    pair < double, double > compute_force_on_pair(
+                 const pair < double, double > &pos,
+                 double theta = 0.5
+            ) const
+    {
+        Point force;
+        compute_force(Point(pos.first, pos.second), force, theta);
+        return make_pair(force.x, force.y);
+    }
+
+    // compute the forces on all `positions` in parallel, the result
+    // contains interleaved (x, y)-pairs
+    void compute_forces(
+                 const vector < Point > &positions,
+                 double* forces,
+                 double theta = 0.5,
+                 size_t n_threads = 0
+            ) const
+    {
+        vector < size_t > order = get_hilbert_order(positions, geom.left(), geom.bottom(),
+                                                    geom.width(), geom.height());
+        parallel_for(positions.size(), n_threads, [&](size_t k, size_t){
+            size_t i = order[k];
+            Point force;
+            compute_force(positions[i], force, theta);
+            forces[2*i] = force.x;
+            forces[2*i+1] = force.y;
+        }, "traverse");
+    }
+
+    // see `QuadTree::get_distances_to`
+    void get_distances_to(
+                 const Point &pos,
+                 vector < pair < double, size_t > > &distances,
+                 const double &theta = 0.2,
+                 const bool &ignore_zero_distance = true,
+                 const PersistentNode* node = NULL
+            ) const
+    {
+        if (node == NULL){
+            if (root == NULL)
+                return;
+            node = root.get();
+        }
+
+        collect_distances(*this, node, pos, distances, theta, ignore_zero_distance);
+    }
+
+    vector < pair < double, size_t > > get_distances_to_pair(
+                 const pair < double, double > &pos,
+                 const double &theta = 0.2,
+                 const bool &ignore_zero_distance = true
+            ) const
+    {
+        vector < pair < double, size_t > > distances;
+        get_distances_to(Point(pos.first, pos.second), distances, theta, ignore_zero_distance);
+        return distances;
+    }
+};
+
+// A tree that is updated by path copying. Every insertion publishes
+// a new version atomically, readers take snapshots with `snapshot()`
+// and are never blocked by writers. Writers are serialized with a mutex.
+// The root extent doubles towards points that are inserted outside of it.
+class VersionedQuadTree
+{
+  private:
+    PersistentNodePointer root;   // the latest version, guarded by writer_mutex
+    Extent geom;                  // guarded by writer_mutex
+    size_t version = 0;           // guarded by writer_mutex
+    shared_ptr < const QuadTreeSnapshot > current; // the published version, only accessed
+                                                   // with atomic_load/atomic_store
+    mutex writer_mutex;
+
+    // double the root extent towards `pos` (writer_mutex must be held),
+    // the old root becomes a quadrant of the new root
+    void _grow_to_contain(const Point &pos){
+
+        while (!geom.contains(pos)){
+
+            bool grow_left = pos.x < geom.left();
+            bool grow_down = pos.y < geom.bottom();
+            double w = geom.width();
+            double h = geom.height();
+
+            int old_quad;
+            if (grow_left)
+                old_quad = grow_down ? _NE : _SE;
+            else
+                old_quad = grow_down ? _NW : _SW;
+
+            Extent new_geom(grow_left ? geom.left() - w : geom.left(),
+                            grow_down ? geom.bottom() - h : geom.bottom(),
+                            2*w,
+                            2*h);
+
+            if (root != NULL){
+                shared_ptr < PersistentNode > new_root = make_shared < PersistentNode >(new_geom);
+                new_root->subtrees[old_quad] = root;
+                new_root->total_mass = root->total_mass;
+                new_root->total_mass_position = root->total_mass_position;
+                new_root->center_of_mass = root->center_of_mass;
+                new_root->number_of_contained_points = root->number_of_contained_points;
+                root = new_root;
+            }
+
+            geom = new_geom;
+        }
+    }
+
+    // insert without publishing (writer_mutex must be held)
+    bool _insert(const Point &pos, double mass, PointId id){
+
+        if (!(isfinite(pos.x) && isfinite(pos.y)))
+            return false;
+
+        if (!geom.contains(pos))
+            _grow_to_contain(pos);
+
+        root = insert_persistent(root, geom, pos, mass, id);
+        version++;
+        return true;
+    }
+
+    // make the current version visible to readers (writer_mutex must be held)
+    void _publish(){
+        atomic_store(&current, shared_ptr < const QuadTreeSnapshot >(new QuadTreeSnapshot(root, geom, version)));
+    }
+
+  public:
+
+    VersionedQuadTree(){
+        geom = Extent(0.0, 0.0, 1.0, 1.0);
+        _publish();
+    }
+
+    VersionedQuadTree(const Extent &_geom){
+        if (!(_geom.width() > 0 && _geom.height() > 0))
+            throw invalid_argument("The root extent must have a positive width and height.");
+        geom = _geom;
+        _publish();
+    }
+
+    // get a handle of the current version
+    QuadTreeSnapshot snapshot() const {
+        return *atomic_load(&current);
+    }
+
+    // insert a single point and publish the new version,
+    // returns false if the position is not finite
+    bool insert(const Point &pos, double mass = 1.0, PointId id = -1){
+        lock_guard < mutex > guard(writer_mutex);
+        bool inserted = _insert(pos, mass, id);
+        _publish();
+        return inserted;
+    }
+
+    bool insert_pair(const pair < double, double > &pos, double mass = 1.0, PointId id = -1){
+        return insert(Point(pos.first, pos.second), mass, id);
+    }
+
+    // insert a batch of points and publish a single new version afterwards,
+    // point i gets the id `first_id + i`. If `masses` is empty, all masses are 1.
+    void insert_positions(
+                 const vector < Point > &positions,
+                 const vector < double > &masses = vector < double >(),
+                 PointId first_id = 0
+            )
+    {
+        if (!masses.empty() && masses.size() != positions.size())
+            throw invalid_argument("positions and masses must have the same length");
+        check_point_ids(first_id, positions.size());
+
+        lock_guard < mutex > guard(writer_mutex);
+        for(size_t i = 0; i < positions.size(); ++i)
+            _insert(positions[i], masses.empty() ? 1.0 : masses[i], first_id + (PointId) i);
+        _publish();
+    }
+};
+
+#endif /* PersistentQuadTree_h */
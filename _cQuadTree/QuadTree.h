@@ -8,17 +8,34 @@
 #define QuadTree_h
 
 #include <Point.h>
+#include <Parallel.h>
+#include <SpaceFillingCurve.h>
+#include <Trace.h>
 #include <tuple>
 #include <cmath>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 
 const int _NW = 0;
 const int _NE = 1;
 const int _SE = 2;
 const int _SW = 3;
 
+// quantities that can be accumulated in a single traversal (bit flags)
+const int _FORCE = 1;
+const int _POTENTIAL = 2;
+const int _MASS_WITHIN_RADIUS = 4;
+const int _NUMBER_OF_INTERACTIONS = 8;
+
 // string representations of the quadrants
 const vector < string > _QUADS = {" (nw)", " (ne)", " (se)", " (sw)"};
 
@@ -27,11 +44,38 @@ using namespace std;
 // reserve name to allow circular reference in class SubTrees
 class QuadTree;
 
+// Returns a new, globally unique stamp for the topology of a tree.
+// Structures that refer to tree nodes (e.g. cached interaction lists)
+// compare stamps to know whether the nodes they refer to are still valid.
+inline size_t get_new_topology_version(){
+    static atomic < size_t > counter(0);
+    return ++counter;
+}
+
+// Point ids are 64-bit integers, such that data sets with more
+// than 2^31 points can be inserted chunk by chunk
+typedef int64_t PointId;
+
+// Throws if a batch of `number_of_points` points whose ids are
+// counted upwards from `first_id` would run past the largest id,
+// instead of letting the ids wrap around.
+inline void check_point_ids(PointId first_id, size_t number_of_points){
+    if (number_of_points == 0)
+        return;
+    const PointId largest_id = numeric_limits < PointId >::max();
+    if (number_of_points - 1 > (size_t) largest_id ||
+        first_id > largest_id - (PointId) (number_of_points - 1))
+        throw overflow_error("Point ids would exceed the largest id " + to_string(largest_id) +
+                             ", insert fewer points or use a smaller first_id.");
+}
+
 class SubTrees
 {
   public:
-    size_t occupied_trees;
-    vector< QuadTree* > trees;
+    // the quadrant pointers and their count are atomic
+    // such that subtrees can be created concurrently (see `QuadTree::insert_concurrent`)
+    atomic < size_t > occupied_trees;
+    atomic < QuadTree* > trees[4];
 
     SubTrees(){
 
@@ -39,36 +83,39 @@ class SubTrees
         occupied_trees = 0;
         
         // therefore, all quadrant pointers point to nothing
-        trees.clear();
+        for(int i=0; i<4; ++i)
+            trees[i] = NULL;
     }
     
-    ~SubTrees(){
-        // delete all subtrees that were created in runtime
-        if (occupied_trees > 0){
-            for(int i=3; i>=0; --i)
-                if (trees[i]) delete trees[i];
-            trees.clear();
-        }
-    }
+    // defined below the QuadTree class, because deleting
+    // a subtree requires the complete type
+    ~SubTrees();
+
+    // delete all subtrees that were created in runtime
+    void clear();
     
     // add a new tree to one of the quadrants,
     // where iqad corresponds to the mapping above
     void add_tree(int iquad, QuadTree* tree){
-        if (occupied_trees == 0){
-            for(int i=0; i<4; ++i)
-                trees.push_back(NULL);
-        }
-        occupied_trees += 1;
         trees[iquad] = tree;
+        occupied_trees += 1;
     }
 
-    QuadTree* get_subtree(int iquad){
+    // add a new tree to one of the quadrants if no other thread
+    // did so already. Returns the tree that occupies the quadrant afterwards.
+    QuadTree* add_tree_if_empty(int iquad, QuadTree* tree){
+        QuadTree* current_tree = NULL;
+        if (trees[iquad].compare_exchange_strong(current_tree, tree)){
+            occupied_trees += 1;
+            return tree;
+        }
+        return current_tree;
+    }
+
+    QuadTree* get_subtree(int iquad) const {
         if (iquad < 0 || iquad > 3)
             throw range_error("The requested quadrant id was out of range [0,3].");
-        if (occupied_trees==0)
-            return NULL;
-        else
-            return trees[iquad];
+        return trees[iquad];
     }
 };
 
@@ -140,6 +187,15 @@ class Extent
         w = other.w;
         h = other.h;
     }
+
+    // copy the attributes of another box
+    Extent &operator=(const Extent &other) = default;
+
+    // whether both boxes have exactly the same corners
+    bool operator==(const Extent &other) const {
+        return botLeft.x == other.botLeft.x && botLeft.y == other.botLeft.y &&
+               topRight.x == other.topRight.x && topRight.y == other.topRight.y;
+    }
     
     // initiate from a list of 2d positions
     Extent(const vector <Point> &positions){
@@ -179,7 +235,7 @@ class Extent
     
     // return a new geometry referring to a box that corresponds to one of the quadrants,
     // accessed by integer id
-    Extent get_quadrant(const int &q){
+    Extent get_quadrant(const int &q) const {
         if (q==_NW){
             return get_NW();
         } else if (q==_NE) {
@@ -194,50 +250,59 @@ class Extent
     }
     
     // return the north-western quadrant
-    Extent get_NW(){
+    Extent get_NW() const {
         Point base = botLeft + Point(0.f,vec.y/2);
         return Extent(base, base + vec/2);
     }
     
     // return the north-eastern quadrant
-    Extent get_NE(){
+    Extent get_NE() const {
         Point base = botLeft + vec/2;
         return Extent(base, base + vec/2);
     }
     
     // return the south-eastern quadrant
-    Extent get_SE(){
+    Extent get_SE() const {
         Point base = botLeft + Point(vec.x/2,0.f);
         return Extent(base, base + vec/2);
     }
     
     // return the south-western quadrant
-    Extent get_SW(){
+    Extent get_SW() const {
         return Extent(botLeft, botLeft + vec/2);
     }
     
+    // return the square with the same bottom-left corner whose sides are as
+    // long as the longer side of this box. The corners of the longer side stay
+    // the same, such that rounding can't put points on them outside of the square.
+    Extent get_square() const {
+        double side = max(w, h);
+        return Extent(botLeft, Point(w >= h ? right() : max(right(), left() + side),
+                                     h >= w ? top() : max(top(), bottom() + side)));
+    }
+
     // return the minimum x-coordinate of this box
-    double left(){
+    double left() const {
         return botLeft.x;
     }
     
     // return the minimum y-coordinate of this box
-    double bottom(){
+    double bottom() const {
         return botLeft.y;
     }
 
     // return the maximum x-coordinate of this box
-    double right(){
+    double right() const {
         return topRight.x;
     }
     
     // return the maximum y-coordinate of this box
-    double top(){
+    double top() const {
         return topRight.y;
     }
     
     // check whether a point lies within a box
-    bool contains(const Point &pos){
+    bool contains(const Point &pos) const {
         return ( pos.x >= left() &&
                  pos.x <= right() &&
                  pos.y <= top() &&
@@ -249,7 +314,7 @@ class Extent
     // this position would lie in.
     // Returns -1 if the position does not
     // lie within the extent of this box
-    int quad_to_insert_to(const Point &pos){
+    int quad_to_insert_to(const Point &pos) const {
         if (contains(pos)){
             // left space
             if (pos.x < right()-w/2) {
@@ -274,36 +339,65 @@ class Extent
     }
 
     // returns width of this box
-    double width(){
+    double width() const {
         return w;
     }
 
     // returns height of this box
-    double height(){
+    double height() const {
         return h;
     }
     
     // returns the vector that points from the lower left to the upper right of the box
-    Point get_vec(){
+    Point get_vec() const {
         return vec;
     }
     
     // returns the vector that contains the coordinates of the box's lower left
-    Point get_bottom_left(){
+    Point get_bottom_left() const {
         return botLeft;
     }
 
     // returns the vector that contains the coordinates of the box's upper right
-    Point get_top_right(){
+    Point get_top_right() const {
         return topRight;
     }
     
     // returns the vector that contains the coordinates of the box's upper left
-    Point get_top_left(){
+    Point get_top_left() const {
         return Point(botLeft.x, topRight.y);
     }
 
-    string tostr() {
+    // returns the squared distance between a point and the closest point of this box
+    // (zero if the point lies within the box)
+    double get_min_distance2_to(const Point &pos) const {
+        double dx = max(max(botLeft.x - pos.x, 0.0), pos.x - topRight.x);
+        double dy = max(max(botLeft.y - pos.y, 0.0), pos.y - topRight.y);
+        return dx*dx + dy*dy;
+    }
+
+    // returns the squared distance between a point and the farthest corner of this box
+    double get_max_distance2_to(const Point &pos) const {
+        double dx = max(fabs(pos.x - botLeft.x), fabs(pos.x - topRight.x));
+        double dy = max(fabs(pos.y - botLeft.y), fabs(pos.y - topRight.y));
+        return dx*dx + dy*dy;
+    }
+
+    // returns the squared minimum distance between any two points of this and another box
+    double get_min_distance2_to(const Extent &other) const {
+        double dx = max(max(botLeft.x - other.topRight.x, 0.0), other.botLeft.x - topRight.x);
+        double dy = max(max(botLeft.y - other.topRight.y, 0.0), other.botLeft.y - topRight.y);
+        return dx*dx + dy*dy;
+    }
+
+    // returns the squared maximum distance between any two points of this and another box
+    double get_max_distance2_to(const Extent &other) const {
+        double dx = max(fabs(other.topRight.x - botLeft.x), fabs(topRight.x - other.botLeft.x));
+        double dy = max(fabs(other.topRight.y - botLeft.y), fabs(topRight.y - other.botLeft.y));
+        return dx*dx + dy*dy;
+    }
+
+    string tostr() const {
         ostringstream ss;
         ss << "Extent(left=" << left() 
            << ",bottom=" << bottom() 
@@ -316,6 +410,178 @@ class Extent
 };
 
 
+// quantities that are accumulated for a query point in
+// `QuadTree::compute_quantities`
+class PointQuantities
+{
+  public:
+    Point force = Point(0.f, 0.f);       // sum of m d / |d|^3
+    double potential = 0.f;              // sum of -m / |d|
+    double mass_within_radius = 0.f;     // total mass of interacting nodes closer than the radius
+    size_t number_of_interactions = 0;   // number of leaves and internal nodes interacted with
+};
+
+// flat representation of all nodes of a tree, where
+// the i-th entry of every node array belongs to the i-th
+// node in depth-first pre-order (the root has index 0)
+class TreeArrays
+{
+  public:
+    // one entry per node
+    vector < double > left;
+    vector < double > bottom;
+    vector < double > width;
+    vector < double > height;
+    vector < int > depth;
+    vector < long > parent;              // index of the parent node, -1 for the root
+    vector < double > mass;              // total mass of the node
+    vector < double > center_of_mass;    // interleaved (x, y)-pairs
+    vector < size_t > number_of_contained_points;
+
+    // one entry per leaf
+    vector < double > leaf_positions;    // interleaved (x, y)-pairs
+    vector < PointId > leaf_ids;
+    vector < long > leaf_nodes;          // index of the leaf in the node arrays
+
+    size_t number_of_nodes() const {
+        return left.size();
+    }
+
+    size_t number_of_leaves() const {
+        return leaf_ids.size();
+    }
+};
+
+// Points of a lazy bucket (see `QuadTree::insert_positions_lazily`) that
+// have not been distributed to subtrees yet. Buckets are held out of line,
+// such that nodes that are no buckets only pay for a null pointer.
+class LazyBucket
+{
+  public:
+    vector < Point > positions;
+    vector < double > masses;
+    vector < PointId > ids;
+};
+
+// First pass over a binary file of interleaved (x, y)-pairs of 64-bit floats
+// that finds the bounding box of all positions while only holding
+// `chunk_size` positions in memory.
+inline Extent get_extent_of_binary_file(
+              const string &filename,
+              size_t chunk_size = 1048576,
+              bool const &force_square = true
+            )
+{
+    if (chunk_size == 0)
+        throw invalid_argument("chunk_size must be positive");
+
+    ifstream file(filename, ios::in | ios::binary);
+    if (!file)
+        throw runtime_error("Could not open file " + filename);
+
+    vector < double > buffer(2*chunk_size);
+
+    double minX = 0, maxX = 0, minY = 0, maxY = 0;
+    bool noPointSet = true;
+    while (file) {
+        file.read(reinterpret_cast < char* >(buffer.data()), buffer.size()*sizeof(double));
+        size_t n_read = (size_t) file.gcount() / (2*sizeof(double));
+        for(size_t i = 0; i < n_read; ++i){
+            double x = buffer[2*i];
+            double y = buffer[2*i+1];
+            if (noPointSet){
+                minX = maxX = x;
+                minY = maxY = y;
+                noPointSet = false;
+            } else {
+                minX = min(minX, x);
+                maxX = max(maxX, x);
+                minY = min(minY, y);
+                maxY = max(maxY, y);
+            }
+        }
+    }
+
+    Extent geom(Point(minX, minY), Point(maxX, maxY));
+    if (force_square)
+        geom = geom.get_square();
+
+    return geom;
+}
+
+// Barnes-Hut traversals that are shared by `QuadTree` and the persistent
+// trees (`QuadTreeSnapshot`). The tree provides the displacement between
+// two points (`get_displacement`), the acceptance criterion (`accepts`),
+// and the subtrees of a node (`for_each_subtree`), nodes provide `is_leaf()`,
+// `this_pos`, `center_of_mass`, `total_mass`, and `number_of_contained_points`.
+
+// Whether a node whose points lie within `bounds` looks small enough from
+// the displacement `d` to its center of mass to be treated as a single point.
+inline bool is_within_opening_angle(const Extent &bounds, const Point &d, double theta){
+    double s2 = bounds.width() * bounds.height(); // geometric mean of box dimensions
+    return (s2/d.length2()) < theta*theta;
+}
+
+// the force of a point mass at displacement `d`, points at zero distance exert no force
+inline Point get_point_force(double mass, const Point &d){
+    double norm2 = d.length2();
+    if (norm2 > 0)
+        return mass * d/pow(norm2,1.5);
+    return Point(0.f, 0.f);
+}
+
+// add the force on `pos` of all points below `node` to `force`
+template < typename Tree, typename Node >
+void accumulate_force(
+              const Tree &tree,
+              const Node* node,
+              const Point &pos,
+              Point &force,
+              double theta
+        )
+{
+    if (node->is_leaf()){
+        force += get_point_force(node->total_mass, tree.get_displacement(pos, node->this_pos));
+        return;
+    }
+
+    Point d = tree.get_displacement(pos, node->center_of_mass);
+    if (tree.accepts(node, d, theta))
+        force += get_point_force(node->total_mass, d);
+    else
+        tree.for_each_subtree(node, [&](const Node* subtree){
+            accumulate_force(tree, subtree, pos, force, theta);
+        });
+}
+
+// append the distances of `pos` to all points below `node` (and the
+// number of points at every distance) to `distances`
+template < typename Tree, typename Node >
+void collect_distances(
+              const Tree &tree,
+              const Node* node,
+              const Point &pos,
+              vector < pair < double, size_t > > &distances,
+              double theta,
+              bool ignore_zero_distance
+        )
+{
+    if (node->is_leaf()){
+        double norm2 = tree.get_displacement(pos, node->this_pos).length2();
+        if ((norm2 > 0) || (!ignore_zero_distance))
+            distances.push_back(make_pair(sqrt(norm2), node->number_of_contained_points));
+        return;
+    }
+
+    Point d = tree.get_displacement(pos, node->center_of_mass);
+    if (tree.accepts(node, d, theta))
+        distances.push_back(make_pair(sqrt(d.length2()), node->number_of_contained_points));
+    else
+        tree.for_each_subtree(node, [&](const Node* subtree){
+            collect_distances(tree, subtree, pos, distances, theta, ignore_zero_distance);
+        });
+}
+
 // A tree root that contains positions and subtrees
 class QuadTree
 {
@@ -334,10 +600,393 @@ class QuadTree
         number_of_contained_points++;
     }
 
+    atomic < bool > _locked { false }; // guards data of this node during concurrent insertion
+    atomic < bool > _lazy { false };   // whether this node is a bucket that has not been split up yet
+
+    void _lock(){
+        while (_locked.exchange(true, memory_order_acquire))
+            this_thread::yield();
+    }
+
+    void _unlock(){
+        _locked.store(false, memory_order_release);
+    }
+
+    // The points of this node if it's a lazy bucket that has not been split
+    // up yet, NULL otherwise. The aggregates of the node already include them.
+    // Concurrent queries only look at `_lazy`, which is set while `bucket`
+    // is not NULL, and touch `bucket` under `_locked` (see `_refine_if_lazy`).
+    unique_ptr < LazyBucket > bucket;
+
+    // turn this empty node into a bucket that holds the given points
+    void _make_bucket(vector < Point > &positions, vector < double > &masses, vector < PointId > &ids){
+        for(size_t i = 0; i < positions.size(); ++i)
+            _update_data(positions[i], masses[i]);
+        bucket.reset(new LazyBucket());
+        bucket->positions.swap(positions);
+        bucket->masses.swap(masses);
+        bucket->ids.swap(ids);
+        _lazy = true;
+    }
+
+    // put a single point into this empty node
+    void _make_leaf(Point &pos, double mass, PointId id){
+        Point _pos(min(max(pos.x, geom.left()), geom.right()),
+                   min(max(pos.y, geom.bottom()), geom.top()));
+        this_pos = pos;
+        this_mass = mass;
+        this_id = id;
+        current_data_quadrant = geom.quad_to_insert_to(_pos);
+        _update_data(pos, mass);
+    }
+
+    // distribute the points of this bucket to its quadrants, quadrants with
+    // a single point become leaves, all others become buckets themselves
+    void _split_bucket(){
+
+        TraceScope scope("refine");
+
+        vector < Point > positions[4];
+        vector < double > masses[4];
+        vector < PointId > ids[4];
+
+        for(size_t i = 0; i < bucket->positions.size(); ++i){
+            // points might lie outside of the box after `refit`,
+            // put them into the closest quadrant
+            Point pos(min(max(bucket->positions[i].x, geom.left()), geom.right()),
+                      min(max(bucket->positions[i].y, geom.bottom()), geom.top()));
+            int quad = geom.quad_to_insert_to(pos);
+            positions[quad].push_back(bucket->positions[i]);
+            masses[quad].push_back(bucket->masses[i]);
+            ids[quad].push_back(bucket->ids[i]);
+        }
+
+        for(int quad = 0; quad < 4; ++quad){
+            if (positions[quad].empty())
+                continue;
+            QuadTree* subtree = new QuadTree(geom.get_quadrant(quad), this);
+            // a point that lies at most `box_slack` outside of this box lies
+            // at most as far outside of the quadrant it was clamped into
+            subtree->box_slack = box_slack;
+            if (positions[quad].size() == 1)
+                subtree->_make_leaf(positions[quad][0], masses[quad][0], ids[quad][0]);
+            else
+                subtree->_make_bucket(positions[quad], masses[quad], ids[quad]);
+            subtrees.add_tree(quad, subtree);
+        }
+
+        bucket.reset();
+    }
+
+    // move data, subtrees, and mass aggregates of this node to
+    // an empty node and leave this node empty
+    void _move_content_to(QuadTree* other){
+
+        other->this_pos = this_pos;
+        other->this_id = this_id;
+        other->this_mass = this_mass;
+        other->current_data_quadrant = current_data_quadrant;
+        other->total_mass = total_mass;
+        other->total_mass_position = total_mass_position;
+        other->center_of_mass = center_of_mass;
+        other->number_of_contained_points = number_of_contained_points;
+        other->box_slack = box_slack;
+        for(int i=0; i<4; ++i){
+            QuadTree* subtree = subtrees.trees[i].exchange(NULL);
+            other->subtrees.trees[i] = subtree;
+            if (subtree != NULL)
+                subtree->parent = other;
+        }
+        other->subtrees.occupied_trees = subtrees.occupied_trees.exchange(0);
+        other->bucket = move(bucket);
+        other->_lazy = _lazy.exchange(false);
+
+        this_pos = Point(nan(""), nan(""));
+        this_id = -1;
+        this_mass = 0.f;
+        current_data_quadrant = -1;
+        total_mass = 0.f;
+        total_mass_position = Point(0.f, 0.f);
+        center_of_mass = Point(0.f, 0.f);
+        number_of_contained_points = 0;
+        box_slack = 0.f;
+    }
+
+    // For compressed trees: put a new internal node between this node and
+    // its subtree in quadrant `iquad`, whose box is the smallest quadrant cell
+    // that contains both the subtree and `pos` in different quadrants.
+    // Returns the new node (or the old subtree if the two can't be separated).
+    QuadTree* _insert_separating_node(int iquad, const Point &pos){
+
+        QuadTree* child = subtrees.get_subtree(iquad);
+
+        // a leaf is represented by its position, a subtree by the center of its box
+        Point reference = child->is_leaf() ? child->this_pos
+                                           : child->geom.get_bottom_left() + child->geom.get_vec()/2;
+        if (child->is_leaf() && reference.x == pos.x && reference.y == pos.y)
+            return child;
+
+        Extent cell = geom.get_quadrant(iquad);
+        int child_quad = cell.quad_to_insert_to(reference);
+        int new_quad = cell.quad_to_insert_to(pos);
+
+        while (child_quad >= 0 && child_quad == new_quad && (child->is_leaf() || cell.width() > child->geom.width())){
+            cell = cell.get_quadrant(child_quad);
+            child_quad = cell.quad_to_insert_to(reference);
+            new_quad = cell.quad_to_insert_to(pos);
+        }
+
+        if (child_quad < 0 || new_quad < 0 || child_quad == new_quad)
+            return child;
+
+        QuadTree* node = new QuadTree(cell, this);
+        if (child->is_leaf()){
+            child->geom = cell.get_quadrant(child_quad);
+            child->current_data_quadrant = child->geom.quad_to_insert_to(child->this_pos);
+        }
+        child->parent = node;
+        node->subtrees.add_tree(child_quad, child);
+        node->total_mass = child->total_mass;
+        node->total_mass_position = child->total_mass_position;
+        node->center_of_mass = child->center_of_mass;
+        node->number_of_contained_points = child->number_of_contained_points;
+        node->box_slack = child->box_slack;
+
+        subtrees.trees[iquad] = node;
+
+        return node;
+    }
+
+    // Find the quadrant cells that lead from `root` down to `cell`.
+    // Returns false if `cell` is not a cell of the recursive
+    // subdivision of `root` (up to rounding errors, i.e. corners that
+    // differ by a few units in the last place of the coordinates).
+    static bool _get_path_to_cell(const Extent &root, const Extent &cell, vector < int > &path){
+
+        double scale = max(max(fabs(root.left()), fabs(root.right())),
+                           max(fabs(root.bottom()), fabs(root.top())));
+        double eps = 4 * numeric_limits < double >::epsilon() * scale;
+        Point center = cell.get_bottom_left() + cell.get_vec()/2;
+        Extent node = root;
+        path.clear();
+
+        while (node.width() > cell.width() + eps && node.height() > cell.height() + eps){
+            int quad = node.quad_to_insert_to(center);
+            if (quad < 0)
+                return false;
+            path.push_back(quad);
+            node = node.get_quadrant(quad);
+        }
+
+        return fabs(node.left() - cell.left()) <= eps &&
+               fabs(node.bottom() - cell.bottom()) <= eps &&
+               fabs(node.right() - cell.right()) <= eps &&
+               fabs(node.top() - cell.top()) <= eps;
+    }
+
+    // whether all points below `node` lie within the cells of the
+    // subdivision of `cell` that their nodes correspond to
+    static bool _fits_cell(const QuadTree* node, const Extent &cell){
+
+        if (node->is_leaf())
+            return cell.contains(node->this_pos);
+
+        if (node->_lazy){
+            for(auto const &pos: node->bucket->positions)
+                if (!cell.contains(pos))
+                    return false;
+            return true;
+        }
+
+        for(int quad = 0; quad < 4; ++quad){
+            const QuadTree* subtree = node->subtrees.trees[quad];
+            if (subtree != NULL && !_fits_cell(subtree, cell.get_quadrant(quad)))
+                return false;
+        }
+        return true;
+    }
+
+    // Give `node` and all nodes below it the exact cells of the subdivision of
+    // `cell`, whose extent may differ from the one of `node` by rounding errors
+    // (see `_get_path_to_cell`). The points have to fit the cells (see `_fits_cell`).
+    static void _snap_to_cell(QuadTree* node, const Extent &cell){
+
+        node->geom = cell;
+
+        if (node->is_leaf()){
+            node->current_data_quadrant = cell.quad_to_insert_to(node->this_pos);
+            return;
+        }
+
+        for(int quad = 0; quad < 4; ++quad){
+            QuadTree* subtree = node->subtrees.trees[quad];
+            if (subtree != NULL)
+                _snap_to_cell(subtree, cell.get_quadrant(quad));
+        }
+    }
+
+    // the point of `box` that is closest to `pos`
+    static Point _clamp_to(const Extent &box, const Point &pos){
+        return Point(min(max(pos.x, box.left()), box.right()),
+                     min(max(pos.y, box.bottom()), box.top()));
+    }
+
+    // how far a point lies outside of this node's box along either axis
+    double _get_box_slack(const Point &pos) const {
+        return max(max(max(geom.left() - pos.x, pos.x - geom.right()),
+                       max(geom.bottom() - pos.y, pos.y - geom.top())), 0.0);
+    }
+
+    // recompute the aggregates of an internal node from its subtrees
+    void _sum_up_subtrees(){
+        box_slack = 0.f;
+        total_mass = 0.f;
+        total_mass_position = Point(0.f, 0.f);
+        number_of_contained_points = 0;
+        for(auto &subtree: subtrees.trees){
+            QuadTree* _subtree = subtree;
+            if (_subtree == NULL)
+                continue;
+            total_mass += _subtree->total_mass;
+            total_mass_position += _subtree->total_mass_position;
+            number_of_contained_points += _subtree->number_of_contained_points;
+            box_slack = max(box_slack, _subtree->box_slack);
+        }
+        center_of_mass = total_mass_position / total_mass;
+    }
+
+    // Move all points of `other`, whose box is the same as the one of
+    // `node`, into `node` and leave `other` empty. Quadrants that are
+    // occupied in only one of the nodes are taken over as a whole, only
+    // colliding leaves are re-inserted.
+    void _merge_nodes(QuadTree* node, QuadTree* other){
+
+        if (other->is_empty())
+            return;
+
+        if (node->is_empty()){
+            other->_move_content_to(node);
+            return;
+        }
+
+        if (other->is_leaf()){
+            node->insert(other->this_pos, other->this_mass, other->this_id);
+            QuadTree empty;
+            other->_move_content_to(&empty);
+            return;
+        }
+
+        if (node->is_leaf()){
+            Point pos = node->this_pos;
+            double mass = node->this_mass;
+            PointId id = node->this_id;
+            QuadTree empty;
+            node->_move_content_to(&empty);
+            other->_move_content_to(node);
+            node->insert(pos, mass, id);
+            return;
+        }
+
+        // two buckets, just combine the points
+        if (node->_lazy && other->_lazy){
+            LazyBucket &a = *node->bucket;
+            LazyBucket &b = *other->bucket;
+            a.positions.insert(a.positions.end(), b.positions.begin(), b.positions.end());
+            a.masses.insert(a.masses.end(), b.masses.begin(), b.masses.end());
+            a.ids.insert(a.ids.end(), b.ids.begin(), b.ids.end());
+            node->total_mass += other->total_mass;
+            node->total_mass_position += other->total_mass_position;
+            node->center_of_mass = node->total_mass_position / node->total_mass;
+            node->number_of_contained_points += other->number_of_contained_points;
+            QuadTree empty;
+            other->_move_content_to(&empty);
+            return;
+        }
+
+        node->_refine_if_lazy();
+        other->_refine_if_lazy();
+
+        for(int quad = 0; quad < 4; ++quad){
+            QuadTree* other_subtree = other->subtrees.trees[quad].exchange(NULL);
+            if (other_subtree == NULL)
+                continue;
+            QuadTree* subtree = node->subtrees.get_subtree(quad);
+            if (subtree == NULL){
+                other_subtree->parent = node;
+                node->subtrees.add_tree(quad, other_subtree);
+            } else {
+                _merge_nodes(subtree, other_subtree);
+                delete other_subtree;
+            }
+        }
+        other->subtrees.occupied_trees = 0;
+
+        node->_sum_up_subtrees();
+
+        QuadTree empty;
+        other->_move_content_to(&empty);
+    }
+
+    // For a root box without area, i.e. a segment that all points lie on:
+    // the quadrant that a quadrant of the segment becomes once the box is
+    // extended into a square from its bottom-left corner. The points lie on
+    // the lower (left) edge of the square, which belongs to the southern
+    // (western) quadrants, whereas they were sorted into the northern
+    // (eastern) ones of the flat box.
+    static int _inflated_quadrant(int quad, bool flat_x, bool flat_y){
+        bool east = !flat_x && (quad == _NE || quad == _SE);
+        bool north = !flat_y && (quad == _NW || quad == _NE);
+        if (north)
+            return east ? _NE : _NW;
+        else
+            return east ? _SE : _SW;
+    }
+
+    // Give `node`, whose box has no area, the box `cell` that extends it from
+    // its bottom-left corner and sort its subtrees into the cells of `cell`
+    // they belong to (see `_inflated_quadrant`), without re-inserting points.
+    static void _inflate_to(QuadTree* node, const Extent &cell){
+
+        Extent old_geom = node->geom;
+        bool flat_x = !(old_geom.width() > 0);
+        bool flat_y = !(old_geom.height() > 0);
+        node->geom = cell;
+
+        if (node->is_leaf()){
+            node->current_data_quadrant = cell.quad_to_insert_to(node->this_pos);
+            return;
+        }
+
+        QuadTree* children[4];
+        for(int quad = 0; quad < 4; ++quad)
+            children[quad] = node->subtrees.trees[quad].exchange(NULL);
+
+        for(int quad = 0; quad < 4; ++quad){
+            QuadTree* child = children[quad];
+            if (child == NULL)
+                continue;
+
+            Extent old_cell = old_geom.get_quadrant(quad);
+            int new_quad = _inflated_quadrant(quad, flat_x, flat_y);
+            Extent new_cell = cell.get_quadrant(new_quad);
+
+            // in compressed trees, the box of a child can be a smaller cell of the quadrant
+            Point center = child->geom.get_bottom_left() + child->geom.get_vec()/2;
+            while (max(old_cell.width(), old_cell.height()) > max(child->geom.width(), child->geom.height())){
+                int child_quad = old_cell.quad_to_insert_to(center);
+                old_cell = old_cell.get_quadrant(child_quad);
+                new_cell = new_cell.get_quadrant(_inflated_quadrant(child_quad, flat_x, flat_y));
+            }
+
+            _inflate_to(child, new_cell);
+            node->subtrees.trees[new_quad] = child;
+        }
+    }
+
   public:
 
     Point this_pos = Point(nan(""), nan("")); // a pointer to the vector of the mass point that this tree carries.
-    int this_id = -1;         // integer id of the data point in this node
+    PointId this_id = -1;     // integer id of the data point in this node
     double this_mass = 0.f;    // the mass of the data point in this node
     double total_mass = 0.f;   // total mass of all data points that are contained in this node
                               // xor in all subtrees of this node
@@ -348,8 +997,18 @@ class QuadTree
                                            // in this node xor in all its subtrees
     int current_data_quadrant = -1; // the quadrant the current data lies in
     Extent geom;                    // the geometry of the box of this node
+    double box_slack = 0.f;         // the points below this node lie within `geom` grown by this
+                                    // distance on every side (nonzero only after `refit`)
     SubTrees subtrees;              // the subtrees of this node
     QuadTree* parent = NULL;   // the parent of this node (if root, parent is NULL)
+    bool auto_grow = false;    // whether the root extent grows when a point outside of it is inserted
+    bool compressed = false;   // whether chains of nodes with a single occupied quadrant are collapsed
+    bool periodic = false;     // whether the root extent is a periodic box (see `set_periodic`)
+    Point period = Point(0.f, 0.f); // width and height of the periodic box
+    atomic < size_t > topology_version { get_new_topology_version() }; // changes whenever nodes are
+                                                                       // added to or removed from this root's tree
+    double refit_displacement = 0.f; // the sum of the largest distances a point moved in
+                                     // every `refit` of this root, only ever grows
 
     QuadTree(){
     };
@@ -362,86 +1021,133 @@ class QuadTree
     {
         parent = _parent;
         geom = _geom;
+        if (parent != NULL){
+            compressed = parent->compressed;
+            periodic = parent->periodic;
+            period = parent->period;
+        }
     };
     
     // recursively create a whole tree from a list of positions,
-    // masses will be set to m = 1 for every data point
+    // masses will be set to m = 1 for every data point. With `lazy`,
+    // subtrees are only built when queries need them (see `insert_positions_lazily`)
     QuadTree(vector < Point > & positions,
-             bool const &force_square=true
+             bool const &force_square=true,
+             bool const &_compressed=false,
+             bool const &lazy=false
             )
     {
+        compressed = _compressed;
         geom = Extent(positions);
         if (force_square)
-        {
-            double max_dim = max(geom.width(), geom.height());
-            geom = Extent(geom.left(), geom.bottom(), max_dim, max_dim);
-        }
+            geom = geom.get_square();
 
-        insert_positions(positions);
+        if (lazy)
+            insert_positions_lazily(positions);
+        else
+            insert_positions(positions);
     }
 
     QuadTree(vector < pair < double, double > > & position_pairs,
-                  bool const &force_square=true
+                  bool const &force_square=true,
+                  bool const &_compressed=false,
+             bool const &lazy=false
                   )
     {
+        compressed = _compressed;
 
         vector < Point > positions;
 
-        for(auto const &pos: position_pairs)
-            positions.push_back(Point(pos.first, pos.second));
+        {
+            TraceScope scope("convert");
+            for(auto const &pos: position_pairs)
+                positions.push_back(Point(pos.first, pos.second));
+        }
 
         geom = Extent(positions);
         if (force_square)
-        {
-            double max_dim = max(geom.width(), geom.height());
-            geom = Extent(geom.left(), geom.bottom(), max_dim, max_dim);
-        }
+            geom = geom.get_square();
 
-        insert_positions(positions);
+        if (lazy)
+            insert_positions_lazily(positions);
+        else
+            insert_positions(positions);
     }
 
     QuadTree(vector < pair < double, double > > & position_pairs,
                   vector < double > & masses,
-                  bool const &force_square=true
+                  bool const &force_square=true,
+                  bool const &_compressed=false,
+             bool const &lazy=false
                   )
     {
+        compressed = _compressed;
 
         vector < Point > positions;
 
-        for(auto const &pos: position_pairs)
-            positions.push_back(Point(pos.first, pos.second));
+        {
+            TraceScope scope("convert");
+            for(auto const &pos: position_pairs)
+                positions.push_back(Point(pos.first, pos.second));
+        }
 
         geom = Extent(positions);
         if (force_square)
-        {
-            double max_dim = max(geom.width(), geom.height());
-            geom = Extent(geom.left(), geom.bottom(), max_dim, max_dim);
-        }
+            geom = geom.get_square();
 
-        insert_positions_and_masses(positions, masses);
+        if (lazy)
+            insert_positions_lazily(positions, masses);
+        else
+            insert_positions_and_masses(positions, masses);
     }
 
     // recursively create a whole tree from a list of positions and masses
     QuadTree(vector < Point > & positions,
              vector < double > & masses,
-             bool const &force_square=true
+             bool const &force_square=true,
+             bool const &_compressed=false,
+             bool const &lazy=false
     ){
+        compressed = _compressed;
         geom = Extent(positions);
         if (force_square)
-        {
-            double max_dim = max(geom.width(), geom.height());
-            geom = Extent(geom.left(), geom.bottom(), max_dim, max_dim);
-        }
+            geom = geom.get_square();
 
-        insert_positions_and_masses(positions, masses);
+        if (lazy)
+            insert_positions_lazily(positions, masses);
+        else
+            insert_positions_and_masses(positions, masses);
     }
 
     // insert a data point into the tree, including a mass and an
     // integer id of the data point (to reference the data point later)
-    void insert(Point &new_pos, double mass = 1.0f, int id = -1){
+    void insert(Point &new_pos, double mass = 1.0f, PointId id = -1){
         
+        if (parent == NULL)
+            topology_version = get_new_topology_version();
+
+        // in a periodic box, insert the image of the point that lies within the box
+        // (which is always contained, so this recurses at most once)
+        if (parent == NULL && periodic && !geom.contains(new_pos)){
+            if (!(isfinite(new_pos.x) && isfinite(new_pos.y)))
+                return;
+            Point image = wrap_position(new_pos);
+            insert(image, mass, id);
+            return;
+        }
+
         // find the quadrant of this box that the data point would be inserted to
         int candidate_quad = geom.quad_to_insert_to(new_pos);
+
+        // if the point lies outside the root box, expand the root towards the point
+        if (candidate_quad < 0 && parent == NULL && auto_grow && grow_to_contain(new_pos))
+            candidate_quad = geom.quad_to_insert_to(new_pos);
+
+        // the parent sorted the point into this node, so it lies in this node's box up
+        // to rounding errors (e.g. the box of a former root, see `grow_to_contain`)
+        if (candidate_quad < 0 && parent != NULL)
+            candidate_quad = geom.quad_to_insert_to(_clamp_to(geom, new_pos));
+
         if (candidate_quad < 0) return; // if the candidate is -1, the point lies outside the box
         
         // if this tree node carries no data and no subtrees (i.e. is empty),
@@ -455,6 +1161,16 @@ class QuadTree
             return;
         }
         
+        // if this tree node is a bucket that has not been split up yet, just add the data
+        if (_lazy){
+            Point pos = new_pos;
+            bucket->positions.push_back(pos);
+            bucket->masses.push_back(mass);
+            bucket->ids.push_back(id);
+            _update_data(pos, mass);
+            return;
+        }
+
         // if this tree node carries no data but has subtrees (i.e. is an internal node of the tree),
         // find the subtree/quadrant this position would lie in and insert it in there
         if (is_internal_node()){
@@ -466,6 +1182,12 @@ class QuadTree
                 tree_to_insert_to = new QuadTree(geom.get_quadrant(candidate_quad), this);
                 subtrees.add_tree(candidate_quad, tree_to_insert_to);
             }
+            // in a compressed tree, don't descend into a leaf (which would be split into
+            // a chain of nodes) or into a subtree whose box doesn't contain the data,
+            // but create a node that separates the old and new data right away
+            else if (compressed && (tree_to_insert_to->is_leaf() || !tree_to_insert_to->geom.contains(new_pos))){
+                tree_to_insert_to = _insert_separating_node(candidate_quad, new_pos);
+            }
 
             // insert the data into either (a) this new leaf node or (b) the already existing tree
             tree_to_insert_to->insert(new_pos,mass,id);
@@ -496,8 +1218,267 @@ class QuadTree
         }
     }
 
-    void insert_positions(vector < Point > & positions){
-        int i = 0;
+    // Insert a data point such that several threads can insert into
+    // the same tree at the same time. Empty quadrants are claimed with
+    // an atomic compare-and-swap and only nodes that carry data
+    // (leaves) are locked while they're split up. Mass aggregates
+    // are not updated along the way, call `update_aggregates` once
+    // all threads are done inserting. The root does not grow, returns
+    // false if the point lies outside of the root box. Compressed trees
+    // are not supported.
+    bool insert_concurrent(const Point &new_pos, double mass = 1.0f, PointId id = -1){
+
+        if (compressed)
+            throw logic_error("Concurrent insertion is not supported for compressed trees.");
+
+        // in a periodic box, insert the image of the point that lies within the box
+        if (periodic && !geom.contains(new_pos)){
+            if (!(isfinite(new_pos.x) && isfinite(new_pos.y)))
+                return false;
+            return insert_concurrent(wrap_position(new_pos), mass, id);
+        }
+
+        topology_version = get_new_topology_version();
+
+        QuadTree* node = this;
+
+        while (true) {
+
+            int candidate_quad = node->geom.quad_to_insert_to(new_pos);
+            if (candidate_quad < 0)
+                return false;
+
+            node->_refine_if_lazy();
+
+            // internal node, descend without locking
+            if (node->subtrees.occupied_trees > 0){
+                QuadTree* tree_to_insert_to = node->subtrees.get_subtree(candidate_quad);
+                if (tree_to_insert_to == NULL){
+                    QuadTree* new_tree = new QuadTree(node->geom.get_quadrant(candidate_quad), node);
+                    tree_to_insert_to = node->subtrees.add_tree_if_empty(candidate_quad, new_tree);
+                    if (tree_to_insert_to != new_tree)
+                        delete new_tree;
+                }
+                node = tree_to_insert_to;
+                continue;
+            }
+
+            node->_lock();
+
+            // another thread might have split this node in the meantime
+            if (node->subtrees.occupied_trees > 0){
+                node->_unlock();
+                continue;
+            }
+
+            // empty node, put the data here
+            if (node->this_pos.is_null()){
+                node->this_pos = new_pos;
+                node->this_mass = mass;
+                node->this_id = id;
+                node->current_data_quadrant = candidate_quad;
+                node->_unlock();
+                return true;
+            }
+
+            // leaf node, move the old data to a new subtree. Publishing the subtree
+            // turns this node into an internal node for all other threads.
+            QuadTree* new_tree = new QuadTree(node->geom.get_quadrant(node->current_data_quadrant), node);
+            new_tree->this_pos = node->this_pos;
+            new_tree->this_mass = node->this_mass;
+            new_tree->this_id = node->this_id;
+            new_tree->current_data_quadrant = new_tree->geom.quad_to_insert_to(node->this_pos);
+
+            node->this_mass = 0.f;
+            node->this_pos = Point(nan(""),nan(""));
+            node->this_id = -1;
+            int old_quad = node->current_data_quadrant;
+            node->current_data_quadrant = -1;
+            node->subtrees.add_tree(old_quad, new_tree);
+
+            node->_unlock();
+        }
+    }
+
+    // recompute total mass, center of mass, and number of contained
+    // points of all nodes from the leaves upwards
+    void update_aggregates(QuadTree* node = NULL){
+
+        TraceScope scope(node == NULL ? "aggregate" : NULL);
+
+        if (node == NULL)
+            node = this;
+
+        node->total_mass = 0.f;
+        node->total_mass_position = Point(0.f, 0.f);
+        node->number_of_contained_points = 0;
+        node->box_slack = 0.f;
+
+        if (node->is_leaf()){
+            node->total_mass = node->this_mass;
+            node->total_mass_position = node->this_mass * node->this_pos;
+            node->number_of_contained_points = 1;
+            node->box_slack = node->_get_box_slack(node->this_pos);
+        } else if (node->_lazy){
+            LazyBucket &bucket = *node->bucket;
+            for(size_t i = 0; i < bucket.positions.size(); ++i){
+                node->_update_data(bucket.positions[i], bucket.masses[i]);
+                node->box_slack = max(node->box_slack, node->_get_box_slack(bucket.positions[i]));
+            }
+        } else {
+            for(auto &subtree: node->subtrees.trees){
+                if (subtree != NULL){
+                    update_aggregates(subtree);
+                    QuadTree* _subtree = subtree;
+                    node->total_mass += _subtree->total_mass;
+                    node->total_mass_position += _subtree->total_mass_position;
+                    node->number_of_contained_points += _subtree->number_of_contained_points;
+                    node->box_slack = max(node->box_slack, _subtree->box_slack);
+                }
+            }
+        }
+
+        node->center_of_mass = node->total_mass_position / node->total_mass;
+    }
+
+    // Move every leaf's point to `positions[this_id]` and update the
+    // mass aggregates, without changing the structure of the tree.
+    // This is meant for iterative algorithms where points move
+    // only a little between two iterations: boxes are not adapted,
+    // so points might end up outside of their node's box, which
+    // is recorded in `box_slack`. The largest distance a point moved
+    // is added to `refit_displacement`, such that cached results can
+    // tell how far the tree moved since they were computed.
+    // All ids are checked before any point is moved.
+    // Build a new tree before inserting further points.
+    void refit(const vector < Point > &positions){
+
+        TraceScope scope("refit");
+
+        _check_refit_ids(positions, this);
+        refit_displacement += _refit(positions, this);
+        update_aggregates();
+    }
+
+    // throws if a point below `node` has no position in `positions`
+    void _check_refit_ids(const vector < Point > &positions, const QuadTree* node) const {
+        if (node->is_leaf()){
+            if (node->this_id < 0 || (size_t) node->this_id >= positions.size())
+                throw out_of_range("The id of a leaf does not refer to a position.");
+        } else if (node->_lazy){
+            for(auto id: node->bucket->ids)
+                if (id < 0 || (size_t) id >= positions.size())
+                    throw out_of_range("The id of a leaf does not refer to a position.");
+        } else {
+            for(auto &subtree: node->subtrees.trees)
+                if (subtree != NULL)
+                    _check_refit_ids(positions, subtree);
+        }
+    }
+
+    // move the points below `node`, returns the largest distance a point moved
+    double _refit(const vector < Point > &positions, QuadTree* node){
+
+        double displacement = 0.f;
+
+        if (node->is_leaf()){
+            displacement = get_displacement(node->this_pos, positions[node->this_id]).length();
+            node->this_pos = positions[node->this_id];
+        } else if (node->_lazy){
+            LazyBucket &bucket = *node->bucket;
+            for(size_t i = 0; i < bucket.ids.size(); ++i){
+                const Point &pos = positions[bucket.ids[i]];
+                displacement = max(displacement, get_displacement(bucket.positions[i], pos).length());
+                bucket.positions[i] = pos;
+            }
+        } else {
+            for(auto &subtree: node->subtrees.trees)
+                if (subtree != NULL)
+                    displacement = max(displacement, _refit(positions, subtree));
+        }
+
+        return displacement;
+    }
+
+    // collect all nodes the Barnes-Hut algorithm interacts with when
+    // computing the force on `pos`, i.e. leaves and accepted internal nodes
+    void get_interaction_list(
+                 const Point &pos,
+                 vector < const QuadTree* > &interaction_list,
+                 double theta = 0.5,
+                 const QuadTree* tree = NULL
+            ) const
+    {
+        if (tree == NULL)
+            tree = this;
+
+        if (tree->is_leaf())
+        {
+            interaction_list.push_back(tree);
+        }
+        else
+        {
+            Point d = get_displacement(pos, tree->center_of_mass);
+            if (accepts(tree, d, theta))
+                interaction_list.push_back(tree);
+            else
+                for_each_subtree(tree, [&](const QuadTree* subtree){
+                    get_interaction_list(pos, interaction_list, theta, subtree);
+                });
+        }
+    }
+
+    // insert positions and masses with several threads at once. The root
+    // extent is grown beforehand if necessary (and `auto_grow` is set).
+    void insert_position_pairs_concurrently(
+                  const vector < pair < double, double > > & position_pairs,
+                  const vector < double > & masses,
+                  PointId first_id = 0,
+                  size_t n_threads = 0
+                  )
+    {
+        if (masses.size() != position_pairs.size())
+            throw length_error("masses and positions must be of equal length");
+
+        if (position_pairs.empty())
+            return;
+
+        if (auto_grow){
+            vector < Point > positions;
+            for(auto const &pos: position_pairs)
+                positions.push_back(Point(pos.first, pos.second));
+            Extent bounding_box(positions);
+            if (is_empty() && !(geom.width() > 0 && geom.height() > 0)){
+                geom = bounding_box.get_square();
+            }
+            if (!geom.contains(bounding_box.get_bottom_left()))
+                grow_to_contain(bounding_box.get_bottom_left());
+            if (!geom.contains(bounding_box.get_top_right()))
+                grow_to_contain(bounding_box.get_top_right());
+        }
+
+        check_point_ids(first_id, position_pairs.size());
+        parallel_for(position_pairs.size(), n_threads, [&](size_t i, size_t){
+            Point pos(position_pairs[i].first, position_pairs[i].second);
+            insert_concurrent(pos, masses[i], first_id + (PointId) i);
+        }, "insert");
+
+        update_aggregates();
+    }
+
+    // insert a position and give it a mass and an id, used by the python bindings
+    void insert_pair(const pair < double, double > &pos, double mass = 1.0f, PointId id = -1){
+        Point _pos(pos.first, pos.second);
+        insert(_pos, mass, id);
+    }
+
+    // insert a list of positions with unit mass, the ids of the points
+    // are counted upwards starting from `first_id`, such that
+    // chunks of a large data set can be inserted one after another
+    void insert_positions(vector < Point > & positions, PointId first_id = 0){
+        check_point_ids(first_id, positions.size());
+        TraceScope scope("insert");
+        PointId i = first_id;
         for(auto &pos: positions){
             insert(pos,1.0,i);
             ++i;
@@ -506,15 +1487,18 @@ class QuadTree
 
     void insert_positions_and_masses(
                   vector < Point > & positions,
-                  vector < double > & masses
+                  vector < double > & masses,
+                  PointId first_id = 0
                   )
     {
         // check that every point has a mass
         if (masses.size() != positions.size())
             throw length_error("masses and positions must be of equal length");
-        
+        check_point_ids(first_id, positions.size());
+
+        TraceScope scope("insert");
         auto mass = masses.begin();
-        int i = 0;
+        PointId i = first_id;
         for(auto &pos: positions){
             insert(pos, *mass, i);
             ++mass;
@@ -522,57 +1506,638 @@ class QuadTree
         }
     }
 
-    bool is_leaf(){
+    // insert `n` positions that are given as interleaved (x, y)-pairs,
+    // e.g. straight from the buffer of a NumPy array, without converting
+    // them to a list of points first. If `masses` is NULL, all masses are 1.
+    void insert_position_buffer(
+                  const double* positions,
+                  const double* masses,
+                  size_t n,
+                  PointId first_id = 0
+                  )
+    {
+        check_point_ids(first_id, n);
+        TraceScope scope("insert");
+        for(size_t i = 0; i < n; ++i){
+            Point pos(positions[2*i], positions[2*i+1]);
+            insert(pos, masses == NULL ? 1.0 : masses[i], first_id + (PointId) i);
+        }
+    }
+
+    void insert_position_pairs(
+                  const vector < pair < double, double > > & position_pairs,
+                  PointId first_id = 0
+                  )
+    {
+        check_point_ids(first_id, position_pairs.size());
+        TraceScope scope("insert");
+        PointId i = first_id;
+        for(auto const &pos: position_pairs){
+            insert_pair(pos, 1.0, i);
+            ++i;
+        }
+    }
+
+    void insert_position_pairs_and_masses(
+                  const vector < pair < double, double > > & position_pairs,
+                  const vector < double > & masses,
+                  PointId first_id = 0
+                  )
+    {
+        if (masses.size() != position_pairs.size())
+            throw length_error("masses and positions must be of equal length");
+        check_point_ids(first_id, position_pairs.size());
+
+        TraceScope scope("insert");
+        for(size_t i = 0; i < position_pairs.size(); ++i)
+            insert_pair(position_pairs[i], masses[i], first_id + (PointId) i);
+    }
+
+    // Insert points into this empty root without building the tree: the
+    // root becomes a bucket that only knows the points' total mass and
+    // center of mass. A bucket is split up into its quadrants (which become
+    // buckets themselves) once a query needs to look into it, such that
+    // queries that only touch a small region of the data never build the
+    // rest of the tree. Point i gets the id `first_id + i`. If `masses` is
+    // empty, all masses are 1. Points that lie outside of the root extent
+    // are handled as in `insert`.
+    void insert_positions_lazily(
+                  const vector < Point > & positions,
+                  const vector < double > & masses = vector < double >(),
+                  PointId first_id = 0
+                  )
+    {
+        if (!masses.empty() && masses.size() != positions.size())
+            throw length_error("masses and positions must be of equal length");
+        if (!is_empty())
+            throw logic_error("Points can only be inserted lazily into an empty tree.");
+        if (compressed)
+            throw logic_error("Lazy insertion is not supported for compressed trees.");
+        check_point_ids(first_id, positions.size());
+
+        TraceScope scope("insert");
+        topology_version = get_new_topology_version();
+
+        vector < Point > bucket;
+        vector < double > bucket_mass;
+        vector < PointId > ids;
+        bucket.reserve(positions.size());
+
+        for(size_t i = 0; i < positions.size(); ++i){
+            Point pos = periodic ? wrap_position(positions[i]) : positions[i];
+            if (!(isfinite(pos.x) && isfinite(pos.y)))
+                continue;
+            bucket.push_back(pos);
+            bucket_mass.push_back(masses.empty() ? 1.0 : masses[i]);
+            ids.push_back(first_id + (PointId) i);
+        }
+
+        if (bucket.empty())
+            return;
+
+        if (!periodic && auto_grow){
+            Extent bounding_box(bucket);
+            if (is_empty() && !(geom.width() > 0 && geom.height() > 0)){
+                geom = bounding_box.get_square();
+            }
+            if (!geom.contains(bounding_box.get_bottom_left()))
+                grow_to_contain(bounding_box.get_bottom_left());
+            if (!geom.contains(bounding_box.get_top_right()))
+                grow_to_contain(bounding_box.get_top_right());
+        }
+
+        // drop points that can't be inserted, as `insert` does
+        size_t n = 0;
+        for(size_t i = 0; i < bucket.size(); ++i){
+            if (!geom.contains(bucket[i]))
+                continue;
+            bucket[n] = bucket[i];
+            bucket_mass[n] = bucket_mass[i];
+            ids[n] = ids[i];
+            ++n;
+        }
+        bucket.resize(n);
+        bucket_mass.resize(n);
+        ids.resize(n);
+
+        if (n == 1)
+            insert(bucket[0], bucket_mass[0], ids[0]);
+        else if (n > 1)
+            _make_bucket(bucket, bucket_mass, ids);
+    }
+
+    void insert_position_pairs_lazily(
+                  const vector < pair < double, double > > & position_pairs,
+                  const vector < double > & masses = vector < double >(),
+                  PointId first_id = 0
+                  )
+    {
+        vector < Point > positions;
+        positions.reserve(position_pairs.size());
+        for(auto const &pos: position_pairs)
+            positions.push_back(Point(pos.first, pos.second));
+        insert_positions_lazily(positions, masses, first_id);
+    }
+
+    // stream positions from a binary file that contains
+    // interleaved (x, y)-pairs of 64-bit floats (e.g. written with
+    // numpy's `ndarray.tofile`) and insert them into the tree.
+    // Only `chunk_size` positions are read into memory at a time,
+    // so the root extent `geom` has to be known beforehand
+    // (see `get_extent_of_binary_file`). The tree itself still holds
+    // every point, i.e. its memory grows linearly with the number of
+    // points in the file. Returns the number of positions that were
+    // read from the file.
+    size_t insert_from_binary_file(
+                  const string &filename,
+                  size_t chunk_size = 1048576,
+                  PointId first_id = 0
+                  )
+    {
+        if (chunk_size == 0)
+            throw invalid_argument("chunk_size must be positive");
+
+        ifstream file(filename, ios::in | ios::binary);
+        if (!file)
+            throw runtime_error("Could not open file " + filename);
+
+        // check the ids of all points in the file before inserting any of them
+        file.seekg(0, ios::end);
+        check_point_ids(first_id, (size_t) file.tellg() / (2*sizeof(double)));
+        file.seekg(0, ios::beg);
+
+        vector < double > buffer(2*chunk_size);
+
+        size_t number_of_read_positions = 0;
+        while (file) {
+            file.read(reinterpret_cast < char* >(buffer.data()), buffer.size()*sizeof(double));
+            size_t n_read = (size_t) file.gcount() / (2*sizeof(double));
+
+            insert_position_buffer(buffer.data(), NULL, n_read,
+                                   first_id + (PointId) number_of_read_positions);
+            number_of_read_positions += n_read;
+        }
+
+        return number_of_read_positions;
+    }
+
+    // Expand the root extent until it contains `pos`. The extent
+    // is doubled towards the position and the old root becomes a
+    // quadrant child of the new root, such that the existing
+    // subtree is reused and no point is re-inserted. Returns false
+    // if the position is not finite.
+    bool grow_to_contain(const Point &pos){
+
+        if (!(isfinite(pos.x) && isfinite(pos.y)))
+            return false;
+
+        // a box without area can't be doubled (this is the case for trees
+        // that were created from a single point or from points on a line),
+        // extend it into a square from its bottom-left corner first
+        if (!(geom.width() > 0 && geom.height() > 0)){
+
+            // an empty tree without area has no extent yet
+            if (is_empty()){
+                geom = Extent(pos, pos);
+                return true;
+            }
+
+            // the cells along the extended side stay the same, for a box
+            // without any extent, the square reaches towards `pos`
+            Extent square = geom.get_square();
+            if (!(square.width() > 0)){
+                double side = max(fabs(pos.x - geom.left()), fabs(pos.y - geom.bottom()));
+                square = Extent(geom.get_bottom_left(), side, side);
+            }
+            _inflate_to(this, square);
+        }
+
+        while (!geom.contains(pos)){
+
+            bool grow_left = pos.x < geom.left();
+            bool grow_down = pos.y < geom.bottom();
+            double w = geom.width();
+            double h = geom.height();
+
+            // the old root ends up in the quadrant opposite to the growth direction
+            int old_quad;
+            if (grow_left)
+                old_quad = grow_down ? _NE : _SE;
+            else
+                old_quad = grow_down ? _NW : _SW;
+
+            Extent new_geom(grow_left ? geom.left() - w : geom.left(),
+                            grow_down ? geom.bottom() - h : geom.bottom(),
+                            2*w,
+                            2*h);
+
+            // the old root's box becomes exactly the quadrant cell of the new root,
+            // which can differ from the old box by rounding errors
+            if (!is_empty()){
+                QuadTree* old_root = new QuadTree(new_geom.get_quadrant(old_quad), this);
+                _move_content_to(old_root);
+                if (old_root->is_leaf())
+                    old_root->current_data_quadrant = old_root->geom.quad_to_insert_to(
+                                                        _clamp_to(old_root->geom, old_root->this_pos));
+                subtrees.add_tree(old_quad, old_root);
+                total_mass = old_root->total_mass;
+                total_mass_position = old_root->total_mass_position;
+                center_of_mass = old_root->center_of_mass;
+                number_of_contained_points = old_root->number_of_contained_points;
+                box_slack = old_root->box_slack;
+            }
+
+            geom = new_geom;
+        }
+
+        return true;
+    }
+
+    // Treat the root extent as a periodic box. Points that are inserted
+    // outside of the box are wrapped into it and queries use minimum-image
+    // displacements, i.e. every point interacts with the closest image of
+    // every other point, without replicating the points. The root does not
+    // grow in periodic mode.
+    void set_periodic(bool _periodic = true){
+
+        if (parent != NULL)
+            throw logic_error("Only the root of a tree can be made periodic.");
+
+        if (_periodic && !(geom.width() > 0 && geom.height() > 0))
+            throw invalid_argument("A periodic box must have a positive width and height.");
+
+        if (_periodic)
+            auto_grow = false;
+
+        _set_periodic(_periodic, geom.get_vec(), this);
+    }
+
+    void _set_periodic(bool _periodic, const Point &_period, QuadTree* node){
+        node->periodic = _periodic;
+        node->period = _periodic ? _period : Point(0.f, 0.f);
+        for(auto &subtree: node->subtrees.trees)
+            if (subtree != NULL)
+                _set_periodic(_periodic, _period, subtree);
+    }
+
+    // returns the image of `pos` that lies within the periodic root box,
+    // non-finite positions are returned as they are
+    Point wrap_position(const Point &pos) const {
+        if (!(isfinite(pos.x) && isfinite(pos.y)))
+            return pos;
+        Point image = pos - geom.get_bottom_left();
+        image.x = fmod(image.x, period.x);
+        image.y = fmod(image.y, period.y);
+        if (image.x < 0)
+            image.x += period.x;
+        if (image.y < 0)
+            image.y += period.y;
+        image = geom.get_bottom_left() + image;
+        // the sums above can round to just outside of the box (or overflow
+        // for huge coordinates), clamp the image so that it is always contained
+        image.x = (image.x >= geom.left()) ? min(image.x, geom.right()) : geom.left();
+        image.y = (image.y >= geom.bottom()) ? min(image.y, geom.top()) : geom.bottom();
+        return image;
+    }
+
+    // Move all points of the tree `other` into this tree without
+    // re-inserting them one by one. The root extents have to be aligned,
+    // i.e. either be equal or one of them has to be a cell of the recursive
+    // subdivision of the other (e.g. trees that were built for shards of a
+    // data set with the same root extent, or with extents that are quadrants
+    // of a common root). Quadrants that are occupied in only one of the trees
+    // are taken over as a whole, only colliding leaves are re-inserted,
+    // and the aggregates are updated on the way back up. The cost scales
+    // with the structure the trees share, not with the number of points.
+    // `other` is left empty. Compressed trees are merged by re-inserting
+    // the points of `other`. Periodic trees need equal root extents,
+    // refitted trees can't be merged (see `refit`).
+    void merge(QuadTree &other){
+
+        if (&other == this)
+            throw invalid_argument("A tree can't be merged with itself.");
+        if (parent != NULL || other.parent != NULL)
+            throw logic_error("Only roots of trees can be merged.");
+        if (periodic != other.periodic)
+            throw invalid_argument("Periodic and non-periodic trees can't be merged.");
+        if (periodic && !(geom == other.geom))
+            throw invalid_argument("Periodic trees can only be merged if their boxes are equal.");
+        if (box_slack > 0 || other.box_slack > 0)
+            throw logic_error("Refitted trees can't be merged, build a new tree from the moved points.");
+
+        TraceScope scope("merge");
+        topology_version = get_new_topology_version();
+        other.topology_version = get_new_topology_version();
+
+        if (other.is_empty())
+            return;
+
+        if (compressed || other.compressed){
+            TreeArrays arrays;
+            other.export_arrays(arrays);
+            for(size_t i = 0; i < arrays.number_of_leaves(); ++i){
+                Point pos(arrays.leaf_positions[2*i], arrays.leaf_positions[2*i+1]);
+                insert(pos, arrays.mass[arrays.leaf_nodes[i]], arrays.leaf_ids[i]);
+            }
+            QuadTree empty;
+            other._move_content_to(&empty);
+            return;
+        }
+
+        if (is_empty() && !(geom.width() > 0 && geom.height() > 0))
+            geom = other.geom;
+
+        vector < int > path;
+        bool other_is_larger = false;
+        if (!_get_path_to_cell(geom, other.geom, path)){
+            if (!_get_path_to_cell(other.geom, geom, path))
+                throw invalid_argument("The root extents of the trees are not aligned.");
+            other_is_larger = true;
+        }
+
+        // the smaller root may match its cell only up to rounding errors, it is
+        // given the exact cell unless that would leave any of its points outside
+        // of their nodes' boxes (checked before either tree is changed)
+        const QuadTree &larger = other_is_larger ? other : *this;
+        const QuadTree &smaller = other_is_larger ? *this : other;
+        Extent cell = larger.geom;
+        for(int quad: path)
+            cell = cell.get_quadrant(quad);
+        if (!(cell == smaller.geom) && !_fits_cell(&smaller, cell))
+            throw invalid_argument("The root extents of the trees are only aligned up to rounding "
+                                   "errors and points lie outside of the exact cells.");
+
+        // the other root is larger, swap the trees' contents first
+        if (other_is_larger){
+            QuadTree temp(geom);
+            _move_content_to(&temp);
+            other._move_content_to(this);
+            temp._move_content_to(&other);
+            swap(geom, other.geom);
+        }
+        if (!(cell == other.geom))
+            _snap_to_cell(&other, cell);
+
+        double mass = other.total_mass;
+        Point mass_position = other.total_mass_position;
+        size_t number_of_points = other.number_of_contained_points;
+
+        // walk down to the cell of the other root, leaves on the way are
+        // emptied and their points re-inserted afterwards
+        vector < QuadTree* > nodes = { this };
+        vector < QuadTree* > emptied_leaves;
+        vector < tuple < Point, double, PointId > > emptied_points;
+        for(int quad: path){
+            QuadTree* node = nodes.back();
+            node->_refine_if_lazy();
+            if (node->is_leaf()){
+                emptied_leaves.push_back(node);
+                emptied_points.push_back(make_tuple(node->this_pos, node->this_mass, node->this_id));
+                node->this_pos = Point(nan(""), nan(""));
+                node->this_id = -1;
+                node->this_mass = 0.f;
+                node->current_data_quadrant = -1;
+                node->total_mass = 0.f;
+                node->total_mass_position = Point(0.f, 0.f);
+                node->center_of_mass = Point(0.f, 0.f);
+                node->number_of_contained_points = 0;
+            }
+            QuadTree* subtree = node->subtrees.get_subtree(quad);
+            if (subtree == NULL){
+                subtree = new QuadTree(node->geom.get_quadrant(quad), node);
+                node->subtrees.add_tree(quad, subtree);
+            }
+            nodes.push_back(subtree);
+        }
+
+        _merge_nodes(nodes.back(), &other);
+
+        for(size_t i = 0; i + 1 < nodes.size(); ++i){
+            QuadTree* node = nodes[i];
+            node->total_mass += mass;
+            node->total_mass_position += mass_position;
+            node->center_of_mass = node->total_mass_position / node->total_mass;
+            node->number_of_contained_points += number_of_points;
+        }
+
+        for(size_t i = 0; i < emptied_leaves.size(); ++i)
+            emptied_leaves[i]->insert(get<0>(emptied_points[i]),
+                                      get<1>(emptied_points[i]),
+                                      get<2>(emptied_points[i]));
+
+        if (periodic)
+            _set_periodic(true, period, this);
+    }
+
+    // All const methods below are queries that don't change the tree's
+    // points or aggregates. The only state they change is the structure
+    // below lazy buckets, which they split up when they need to look into
+    // them (see `_refine_if_lazy`, every bucket is split once under its
+    // node's lock). They can be called concurrently from several threads,
+    // as long as no thread modifies the tree at the same time.
+
+    bool is_leaf() const {
         return ((!this_pos.is_null()) && subtrees.occupied_trees == 0);
     }
 
-    bool is_internal_node(){
-        return (this_pos.is_null() && subtrees.occupied_trees > 0);
+    // buckets count as internal nodes, see `_refine_if_lazy`
+    bool is_internal_node() const {
+        return (this_pos.is_null() && (subtrees.occupied_trees > 0 || _lazy));
+    }
+
+    bool is_empty() const {
+        return (this_pos.is_null() && subtrees.occupied_trees == 0 && !_lazy);
+    }
+
+    bool is_lazy() const {
+        return _lazy.load(memory_order_acquire);
+    }
+
+    // Split up this node if it's a lazy bucket. Every traversal calls this
+    // before it looks at the subtrees of a node. The tree's points and
+    // aggregates don't change, which is why this counts as a read-only
+    // operation. Concurrent traversals that open the same bucket are
+    // serialized with the node's lock.
+    void _refine_if_lazy() const {
+        if (!_lazy.load(memory_order_acquire))
+            return;
+        QuadTree* self = const_cast < QuadTree* >(this);
+        self->_lock();
+        if (_lazy.load(memory_order_relaxed)){
+            self->_split_bucket();
+            self->_lazy.store(false, memory_order_release);
+        }
+        self->_unlock();
+    }
+
+    // the box that bounds the points below this node, i.e. its own box grown by
+    // `box_slack` (points can lie outside of it after `refit`), leaves are
+    // bounded by their point
+    Extent get_point_bounds() const {
+        if (is_leaf())
+            return Extent(this_pos, this_pos);
+        Point slack(box_slack, box_slack);
+        return Extent(geom.get_bottom_left() - slack, geom.get_top_right() + slack);
+    }
+
+    // returns the vector that points from `from` to `to`, which is
+    // the shortest vector to any image of `to` in periodic trees
+    Point get_displacement(const Point &from, const Point &to) const {
+        Point d = to - from;
+        if (periodic){
+            d.x -= period.x * round(d.x / period.x);
+            d.y -= period.y * round(d.y / period.y);
+        }
+        return d;
+    }
+
+    // Whether all points of a node can be treated as one when the
+    // displacement to its center of mass is `d`. In periodic trees, this
+    // requires the bounds of the node's points to lie within half a period
+    // of the query point once they're shifted like its center of mass,
+    // otherwise some of its points have closer images than the others.
+    bool is_minimum_image_of_node(const QuadTree* node, const Point &d) const {
+        if (!periodic)
+            return true;
+        Extent bounds = node->get_point_bounds();
+        Point shift = d - node->center_of_mass;
+        Point bottom_left = bounds.get_bottom_left() + shift;
+        Point top_right = bounds.get_top_right() + shift;
+        return max(fabs(bottom_left.x), fabs(top_right.x)) <= period.x/2 &&
+               max(fabs(bottom_left.y), fabs(top_right.y)) <= period.y/2;
+    }
+
+    // The acceptance criterion of all Barnes-Hut queries: whether the points
+    // of the internal node `node` can be treated as a single point at their
+    // center of mass, which lies at the displacement `d` from the query point.
+    bool accepts(const QuadTree* node, const Point &d, double theta) const {
+        return is_within_opening_angle(node->get_point_bounds(), d, theta) &&
+               is_minimum_image_of_node(node, d);
     }
 
-    bool is_empty(){
-        return (this_pos.is_null() && subtrees.occupied_trees == 0);
+    // call `f` with every subtree of `node`, lazy nodes are refined first
+    template < typename Function >
+    void for_each_subtree(const QuadTree* node, Function f) const {
+        node->_refine_if_lazy();
+        for(auto &subtree: node->subtrees.trees){
+            const QuadTree* _subtree = subtree;
+            if (_subtree != NULL)
+                f(_subtree);
+        }
     }
 
     void compute_force(
                  const Point &pos,
                  Point &force,
                  double theta = 0.5,
-                 QuadTree* tree = NULL
-            )
+                 const QuadTree* tree = NULL
+            ) const
     {
 
         if (tree == NULL)
             tree = this;
 
-        if (tree->is_leaf())
-        {
-            Point d = (tree->this_pos) - pos;
-            double norm2 = d.length2();
-            if (norm2 > 0)
-                force += (tree->total_mass) * d/pow(norm2,1.5);
+        accumulate_force(*this, tree, pos, force, theta);
+    }
+
+    // Accumulate several quantities for a query point in a single traversal,
+    // using the same node acceptance criterion as `compute_force`. `quantities`
+    // is a combination of the flags _FORCE, _POTENTIAL, _MASS_WITHIN_RADIUS,
+    // and _NUMBER_OF_INTERACTIONS. Nodes at zero distance do not contribute to
+    // force, potential, or the number of interactions, but count towards the
+    // mass within the radius.
+    void compute_quantities(
+                 const Point &pos,
+                 PointQuantities &result,
+                 int quantities = _FORCE | _POTENTIAL,
+                 double theta = 0.5,
+                 double radius = 0.f,
+                 const QuadTree* tree = NULL
+            ) const
+    {
+        if (tree == NULL)
+            tree = this;
+
+        bool interact = tree->is_leaf();
+        Point d;
+        double norm2;
+
+        if (interact){
+            d = get_displacement(pos, tree->this_pos);
+            norm2 = d.length2();
+        } else {
+            d = get_displacement(pos, tree->center_of_mass);
+            norm2 = d.length2();
+            interact = accepts(tree, d, theta);
         }
-        else
-        {
-            Point _r = tree->center_of_mass;
-            Point d = (_r) - pos;
-            double s2 = tree->geom.width() * tree->geom.height(); // geometric mean of box dimensions
-            double norm2 = d.length2();
-            if ((s2/norm2) < theta*theta)
-                force += (tree->total_mass) * d/pow(norm2,1.5);
-            else
-                for(auto &subtree: tree->subtrees.trees){
-                    if (subtree != NULL){
-                        compute_force(pos, force, theta, subtree);
-                    }
-                }
+
+        if (!interact){
+            for_each_subtree(tree, [&](const QuadTree* subtree){
+                compute_quantities(pos, result, quantities, theta, radius, subtree);
+            });
+            return;
+        }
+
+        double mass = tree->total_mass;
+
+        if ((quantities & _MASS_WITHIN_RADIUS) && norm2 <= radius*radius)
+            result.mass_within_radius += mass;
+
+        if (norm2 > 0){
+            double norm = sqrt(norm2);
+            if (quantities & _FORCE)
+                result.force += get_point_force(mass, d);
+            if (quantities & _POTENTIAL)
+                result.potential -= mass/norm;
+            if (quantities & _NUMBER_OF_INTERACTIONS)
+                result.number_of_interactions++;
         }
     }
 
+    // Returns the order in which a batch of query points is processed.
+    // With `hilbert_order`, queries are sorted along a Hilbert curve over
+    // this node's extent, such that consecutive queries (which end up
+    // in the same thread) open the same nodes and find them in cache.
+    // Otherwise, the queries are processed as given.
+    vector < size_t > get_query_order(
+                 const vector < Point > &positions,
+                 const bool &hilbert_order = true
+            ) const
+    {
+        if (hilbert_order)
+            return get_hilbert_order(positions, geom.left(), geom.bottom(),
+                                     geom.width(), geom.height());
+
+        vector < size_t > order(positions.size());
+        for(size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        return order;
+    }
+
+    // evaluate `compute_quantities` for a list of query points in parallel,
+    // results are stored in the order of `positions`
+    void compute_quantities_for_positions(
+                 const vector < Point > &positions,
+                 vector < PointQuantities > &results,
+                 int quantities = _FORCE | _POTENTIAL,
+                 double theta = 0.5,
+                 double radius = 0.f,
+                 size_t n_threads = 0,
+                 const bool &hilbert_order = true
+            ) const
+    {
+        vector < size_t > order = get_query_order(positions, hilbert_order);
+        results.assign(positions.size(), PointQuantities());
+        parallel_for(positions.size(), n_threads, [&](size_t k, size_t){
+            size_t i = order[k];
+            compute_quantities(positions[i], results[i], quantities, theta, radius);
+        }, "traverse");
+    }
+
     pair < double, double > compute_force_on_pair(
                  const pair < double, double > &pos,
                  double theta = 0.5
-             )
+             ) const
     {
 
         Point force;
@@ -590,43 +2155,21 @@ class QuadTree
                  vector < pair < double, size_t > > &distances,
                  const double &theta = 0.2,
                  const bool &ignore_zero_distance = true,
-                 QuadTree* tree = NULL
-            )
+                 const QuadTree* tree = NULL
+            ) const
     {
         if (tree == NULL)
             tree = this;
-        if (tree->is_leaf())
-        {
-            Point d = (tree->this_pos) - pos;
-            double norm2 = d.length2();
-            if ((norm2 > 0) || (!ignore_zero_distance))
-                distances.push_back(make_pair(sqrt(norm2), 1));
-        }
-        else
-        {
-            Point _r = tree->center_of_mass;
-            Point d = (_r) - pos;
-            double s2 = tree->geom.width() * tree->geom.height(); // geometric mean of box dimensions
-            double norm2 = d.length2();
-            if ((s2/norm2) < theta*theta)
-                distances.push_back(make_pair(sqrt(norm2), (tree->number_of_contained_points)));
-            else
-                for(auto &subtree: tree->subtrees.trees){
-                    if (subtree != NULL){
-                        get_distances_to(pos, distances, theta, 
-                                         ignore_zero_distance,
-                                         subtree);
-                    }
-                }
-        }
+
+        collect_distances(*this, tree, pos, distances, theta, ignore_zero_distance);
     }
 
     vector < pair < double, size_t > > get_distances_to_pair(
                  const pair < double, double > &pos,
                  const double &theta = 0.2,
                  const bool &ignore_zero_distance = true,
-                 QuadTree* tree = NULL
-            )
+                 const QuadTree* tree = NULL
+            ) const
     {
         vector < pair < double, size_t > > distances;
         get_distances_to(Point(pos.first, pos.second), distances, theta, ignore_zero_distance, tree);
@@ -637,8 +2180,8 @@ class QuadTree
                  const vector < pair < double, double > > &positions,
                  const double &theta = 0.2,
                  const bool &ignore_zero_distance = true,
-                 QuadTree* tree = NULL
-            )
+                 const QuadTree* tree = NULL
+            ) const
     {
         vector < pair < double, size_t > > distances;
         for(auto const &pos: positions)
@@ -646,10 +2189,133 @@ class QuadTree
         return distances;
     }
 
+    // count the number of distance-count pairs `get_distances_to`
+    // would produce for this position (first pass of the CSR query)
+    size_t count_distances_to(
+                 const Point &pos,
+                 const double &theta = 0.2,
+                 const bool &ignore_zero_distance = true,
+                 const QuadTree* tree = NULL
+            ) const
+    {
+        if (tree == NULL)
+            tree = this;
+        if (tree->is_leaf())
+        {
+            Point d = get_displacement(pos, tree->this_pos);
+            return ((d.length2() > 0) || (!ignore_zero_distance)) ? 1 : 0;
+        }
+
+        Point d = get_displacement(pos, tree->center_of_mass);
+        if (accepts(tree, d, theta))
+            return 1;
+
+        size_t count = 0;
+        for_each_subtree(tree, [&](const QuadTree* subtree){
+            count += count_distances_to(pos, theta, ignore_zero_distance, subtree);
+        });
+
+        return count;
+    }
+
+    // write the distance-count pairs of this position to the arrays
+    // `distances` and `counts` (second pass of the CSR query),
+    // in the same order as `get_distances_to`.
+    // Returns the number of written entries.
+    size_t fill_distances_to(
+                 const Point &pos,
+                 double* distances,
+                 size_t* counts,
+                 const double &theta = 0.2,
+                 const bool &ignore_zero_distance = true,
+                 const QuadTree* tree = NULL
+            ) const
+    {
+        if (tree == NULL)
+            tree = this;
+        if (tree->is_leaf())
+        {
+            Point d = get_displacement(pos, tree->this_pos);
+            double norm2 = d.length2();
+            if ((norm2 > 0) || (!ignore_zero_distance)){
+                *distances = sqrt(norm2);
+                *counts = 1;
+                return 1;
+            }
+            return 0;
+        }
+
+        Point d = get_displacement(pos, tree->center_of_mass);
+        if (accepts(tree, d, theta)){
+            *distances = sqrt(d.length2());
+            *counts = tree->number_of_contained_points;
+            return 1;
+        }
+
+        size_t written = 0;
+        for_each_subtree(tree, [&](const QuadTree* subtree){
+            written += fill_distances_to(pos,
+                                         distances + written,
+                                         counts + written,
+                                         theta,
+                                         ignore_zero_distance,
+                                         subtree);
+        });
+
+        return written;
+    }
+
+    // compute the distance-count pairs of every query position
+    // in compressed-sparse-row format, i.e. the pairs of query `i` are
+    // `distances[offsets[i]:offsets[i+1]]` and `counts[offsets[i]:offsets[i+1]]`.
+    // The result arrays are filled in parallel by counting the
+    // number of entries per query first, then filling them in.
+    // Queries are processed in the order given by `get_query_order`.
+    void get_distances_to_pairs_csr(
+                 const vector < pair < double, double > > &positions,
+                 vector < size_t > &offsets,
+                 vector < double > &distances,
+                 vector < size_t > &counts,
+                 const double &theta = 0.2,
+                 const bool &ignore_zero_distance = true,
+                 size_t n_threads = 0,
+                 const bool &hilbert_order = true
+            ) const
+    {
+        size_t n = positions.size();
+        offsets.assign(n+1, 0);
+
+        vector < Point > points;
+        points.reserve(n);
+        for(auto const &pos: positions)
+            points.push_back(Point(pos.first, pos.second));
+        vector < size_t > order = get_query_order(points, hilbert_order);
+
+        parallel_for(n, n_threads, [&](size_t k, size_t){
+            size_t i = order[k];
+            offsets[i+1] = count_distances_to(points[i], theta, ignore_zero_distance);
+        }, "traverse");
+
+        for(size_t i = 0; i < n; ++i)
+            offsets[i+1] += offsets[i];
+
+        distances.resize(offsets[n]);
+        counts.resize(offsets[n]);
+
+        parallel_for(n, n_threads, [&](size_t k, size_t){
+            size_t i = order[k];
+            fill_distances_to(points[i],
+                              distances.data() + offsets[i],
+                              counts.data() + offsets[i],
+                              theta,
+                              ignore_zero_distance);
+        }, "traverse");
+    }
+
     vector < pair < double, size_t > > _get_pairwise_distances(
                  const double &theta = 0.2,
                  const bool &ignore_zero_distance = true
-            ){
+            ) const {
         return get_pairwise_distances(theta, ignore_zero_distance);
 
     }
@@ -658,11 +2324,12 @@ class QuadTree
                  const double &theta = 0.2,
                  const bool &ignore_zero_distance = true,
                  vector < pair < double, size_t > >* distances = NULL,
-                 QuadTree* node = NULL,
-                 QuadTree* root = NULL
-            )
+                 const QuadTree* node = NULL,
+                 const QuadTree* root = NULL
+            ) const
     {
-        
+        TraceScope scope(node == NULL ? "traverse" : NULL);
+
         vector < pair < double, size_t > > _distances;
         if (distances == NULL)
             distances = &_distances;
@@ -681,6 +2348,7 @@ class QuadTree
         }
         else
         {
+            node->_refine_if_lazy();
             for(auto &subtree: node->subtrees.trees){
                 if (subtree != NULL)
                     get_pairwise_distances(
@@ -696,13 +2364,56 @@ class QuadTree
         return (*distances);
     }
 
+    // collect all nodes and leaves of the tree in flat arrays,
+    // visiting every node exactly once
+    void export_arrays(
+                 TreeArrays &arrays,
+                 const QuadTree* node = NULL,
+                 long parent_index = -1,
+                 int depth = 0
+            ) const
+    {
+        TraceScope scope(node == NULL ? "materialize" : NULL);
+
+        if (node == NULL)
+            node = this;
+
+        if (node->is_empty())
+            return;
+
+        long index = (long) arrays.number_of_nodes();
+
+        arrays.left.push_back(node->geom.left());
+        arrays.bottom.push_back(node->geom.bottom());
+        arrays.width.push_back(node->geom.width());
+        arrays.height.push_back(node->geom.height());
+        arrays.depth.push_back(depth);
+        arrays.parent.push_back(parent_index);
+        arrays.mass.push_back(node->total_mass);
+        arrays.center_of_mass.push_back(node->center_of_mass.x);
+        arrays.center_of_mass.push_back(node->center_of_mass.y);
+        arrays.number_of_contained_points.push_back(node->number_of_contained_points);
+
+        if (node->is_leaf()){
+            arrays.leaf_positions.push_back(node->this_pos.x);
+            arrays.leaf_positions.push_back(node->this_pos.y);
+            arrays.leaf_ids.push_back(node->this_id);
+            arrays.leaf_nodes.push_back(index);
+        }
+
+        node->_refine_if_lazy();
+        for(auto &subtree: node->subtrees.trees)
+            if (subtree != NULL)
+                export_arrays(arrays, subtree, index, depth+1);
+    }
+
     // recursively construct a string stream representation of the tree
     void get_tree_str(
                       ostringstream &ss,
-                      QuadTree* node = NULL,
+                      const QuadTree* node = NULL,
                       string indent = "",
                       string quad = ""
-                   ){
+                   ) const {
 
         if (node == NULL)
             node = this;
@@ -717,6 +2428,7 @@ class QuadTree
                << "n = " << node->number_of_contained_points << endl;
 
             int i = 0;
+            node->_refine_if_lazy();
             for(auto &subtree: node->subtrees.trees){
                 if (subtree != NULL)
                     get_tree_str(ss,subtree,indent + "| ",_QUADS[i]);
@@ -725,7 +2437,19 @@ class QuadTree
         }
     }
 
+    vector < const QuadTree* > get_subtrees() const {
+        _refine_if_lazy();
+        vector < const QuadTree* > _sbtrs;
+        for(int i=0; i<4; ++i){
+            const QuadTree* this_sub = subtrees.get_subtree(i);
+            if (this_sub != NULL)
+                _sbtrs.push_back(this_sub);
+        }
+        return _sbtrs;
+    }
+
     vector < QuadTree* > get_subtrees(){
+        _refine_if_lazy();
         vector < QuadTree* > _sbtrs;
         for(int i=0; i<4; ++i){
             QuadTree* this_sub = subtrees.get_subtree(i);
@@ -735,17 +2459,23 @@ class QuadTree
         return _sbtrs;
     }
 
+    const QuadTree* get_subtree(int i) const {
+        _refine_if_lazy();
+        return subtrees.get_subtree(i);
+    }
+
     QuadTree* get_subtree(int i){
+        _refine_if_lazy();
         return subtrees.get_subtree(i);
     }
 
-    string str() {
+    string str() const {
       ostringstream ss;
       get_tree_str(ss);
       return ss.str();
     }
 
-    string tostr() {
+    string tostr() const {
       ostringstream ss;
       ss << "QuadTree(" << endl;
       ss << "    geom=" << geom.tostr() << "," << endl;
@@ -763,7 +2493,7 @@ class QuadTree
           ss << "    center_of_mass=" << center_of_mass.tostr() << "," << endl;
           ss << "    total_mass=" << total_mass << "," << endl ;
           ss << "    total_mass_position=" << total_mass_position.tostr() << "," << endl;
-          ss << "    number_of_occupied_subtrees=" << subtrees.occupied_trees << endl;
+          ss << "    number_of_occupied_subtrees=" << subtrees.occupied_trees.load() << endl;
       }
       ss << ")";
       return ss.str();
@@ -771,6 +2501,17 @@ class QuadTree
     
 };
 
+inline SubTrees::~SubTrees(){
+    clear();
+}
+
+inline void SubTrees::clear(){
+    for(int i=3; i>=0; --i){
+        QuadTree* tree = trees[i].exchange(NULL);
+        if (tree) delete tree;
+    }
+    occupied_trees = 0;
+}
 
 #endif /* QuadTree_h */
 
@@ -0,0 +1,95 @@
+//
+//  SpaceFillingCurve.h
+//
+//  Order points along a Hilbert curve, such that points that are
+//  close in the order are close in space.
+//
+
+#ifndef SpaceFillingCurve_h
+#define SpaceFillingCurve_h
+
+#include <Point.h>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// number of bits per dimension the positions are quantized to
+const int _HILBERT_ORDER = 16;
+
+// Returns the index of the cell `pos` lies in along a Hilbert curve
+// that fills the box with lower left corner (left, bottom) and the given
+// width and height with 2^_HILBERT_ORDER x 2^_HILBERT_ORDER cells.
+// Positions outside of the box are assigned to the closest cell.
+inline uint64_t get_hilbert_index(const Point &pos,
+                                  const double &left,
+                                  const double &bottom,
+                                  const double &width,
+                                  const double &height
+                                  ){
+
+    const uint64_t n = ((uint64_t) 1) << _HILBERT_ORDER;
+
+    // quantize the position to the grid
+    uint64_t cell[2];
+    double relative[2] = {
+        width > 0 ? (pos.x - left) / width : 0.0,
+        height > 0 ? (pos.y - bottom) / height : 0.0
+    };
+    for(int k = 0; k < 2; ++k){
+        double c = relative[k] * n;
+        if (!(c > 0))
+            cell[k] = 0;
+        else if (c >= n)
+            cell[k] = n-1;
+        else
+            cell[k] = (uint64_t) c;
+    }
+
+    uint64_t x = cell[0], y = cell[1];
+    uint64_t index = 0;
+    for(uint64_t s = n/2; s > 0; s /= 2){
+        uint64_t rx = (x & s) > 0;
+        uint64_t ry = (y & s) > 0;
+        index += s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant such that the curve is continuous
+        if (ry == 0){
+            if (rx == 1){
+                x = n-1 - x;
+                y = n-1 - y;
+            }
+            swap(x, y);
+        }
+    }
+
+    return index;
+}
+
+// Returns the indices of `positions` sorted along a Hilbert curve
+// over the given box. Processing query points in this order means that
+// consecutive queries traverse the same parts of a tree.
+inline vector < size_t > get_hilbert_order(const vector < Point > &positions,
+                                           const double &left,
+                                           const double &bottom,
+                                           const double &width,
+                                           const double &height
+                                           ){
+
+    vector < pair < uint64_t, size_t > > keys;
+    keys.reserve(positions.size());
+    for(size_t i = 0; i < positions.size(); ++i)
+        keys.push_back(make_pair(get_hilbert_index(positions[i], left, bottom, width, height), i));
+
+    sort(keys.begin(), keys.end());
+
+    vector < size_t > order;
+    order.reserve(keys.size());
+    for(auto const &key: keys)
+        order.push_back(key.second);
+
+    return order;
+}
+
+#endif /* SpaceFillingCurve_h */
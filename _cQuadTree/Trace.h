@@ -0,0 +1,179 @@
+//
+//  Trace.h
+//
+//  Scoped timing of the phases of build and query pipelines
+//  (conversion, insertion, aggregation, traversal, materialization).
+//  Tracing is switched on at runtime, every thread records its
+//  spans in its own buffer. When tracing is off, a scope costs
+//  a single atomic load.
+//
+
+#ifndef Trace_h
+#define Trace_h
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+// a finished span of a traced phase, times are given in
+// microseconds since the first use of the trace clock
+class TraceEvent
+{
+  public:
+    const char* name;
+    size_t thread_id;
+    double start;
+    double duration;
+};
+
+// the spans recorded by one thread, only the owning thread appends,
+// the mutex is uncontended unless events are read at the same time
+class TraceBuffer
+{
+  public:
+    size_t thread_id = 0;
+    vector < TraceEvent > events;
+    mutex buffer_mutex;
+};
+
+// the per-thread buffers, a buffer is kept alive after its thread ended
+// such that no spans are lost, until the spans are cleared. Every thread
+// holds a reference to its own buffer, so a buffer that is only referred
+// to by the registry belongs to a thread that has exited.
+class TraceRegistry
+{
+  public:
+    mutex registry_mutex;
+    vector < shared_ptr < TraceBuffer > > buffers;
+    size_t number_of_threads = 0;   // threads that ever recorded a span, gives the thread ids
+};
+
+inline atomic < bool > &get_tracing_flag(){
+    static atomic < bool > enabled(false);
+    return enabled;
+}
+
+inline TraceRegistry &get_trace_registry(){
+    static TraceRegistry registry;
+    return registry;
+}
+
+inline chrono::steady_clock::time_point get_trace_origin(){
+    static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+    return origin;
+}
+
+// microseconds since the trace origin
+inline double get_trace_time(){
+    return chrono::duration < double, micro >(chrono::steady_clock::now() - get_trace_origin()).count();
+}
+
+// the buffer of the calling thread, registered on first use
+inline TraceBuffer &get_thread_trace_buffer(){
+    thread_local shared_ptr < TraceBuffer > buffer;
+    if (buffer == NULL){
+        buffer = make_shared < TraceBuffer >();
+        TraceRegistry &registry = get_trace_registry();
+        lock_guard < mutex > guard(registry.registry_mutex);
+        buffer->thread_id = registry.number_of_threads++;
+        registry.buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+inline void enable_tracing(bool enabled = true){
+    get_trace_origin();
+    get_tracing_flag().store(enabled, memory_order_relaxed);
+}
+
+inline bool is_tracing_enabled(){
+    return get_tracing_flag().load(memory_order_relaxed);
+}
+
+// discard all recorded spans, along with the buffers of threads that
+// have exited (e.g. the workers of finished `parallel_for` calls)
+inline void clear_trace(){
+    TraceRegistry &registry = get_trace_registry();
+    lock_guard < mutex > guard(registry.registry_mutex);
+    registry.buffers.erase(remove_if(registry.buffers.begin(), registry.buffers.end(),
+                                     [](const shared_ptr < TraceBuffer > &buffer){
+                                         return buffer.use_count() == 1;
+                                     }),
+                           registry.buffers.end());
+    for(auto &buffer: registry.buffers){
+        lock_guard < mutex > buffer_guard(buffer->buffer_mutex);
+        buffer->events.clear();
+    }
+}
+
+// collect the spans of all threads
+inline vector < TraceEvent > get_trace_events(){
+    vector < TraceEvent > events;
+    TraceRegistry &registry = get_trace_registry();
+    lock_guard < mutex > guard(registry.registry_mutex);
+    for(auto &buffer: registry.buffers){
+        lock_guard < mutex > buffer_guard(buffer->buffer_mutex);
+        events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+    }
+    return events;
+}
+
+// all spans in the Chrome trace-event format (complete events),
+// to be loaded in chrome://tracing or Perfetto
+inline string get_chrome_trace(){
+    ostringstream ss;
+    ss.precision(15);
+    ss << "{\"traceEvents\":[";
+    bool first = true;
+    for(auto const &event: get_trace_events()){
+        if (!first)
+            ss << ",";
+        first = false;
+        ss << "{\"name\":\"" << event.name << "\""
+           << ",\"cat\":\"cQuadTree\",\"ph\":\"X\",\"pid\":0"
+           << ",\"tid\":" << event.thread_id
+           << ",\"ts\":" << event.start
+           << ",\"dur\":" << event.duration << "}";
+    }
+    ss << "],\"displayTimeUnit\":\"ms\"}";
+    return ss.str();
+}
+
+// Records the time between its construction and its destruction as a
+// span of the phase `name` (a string literal), if tracing is enabled
+// at construction. A NULL name records nothing.
+class TraceScope
+{
+  private:
+    const char* name = NULL;
+    double start = 0.0;
+
+  public:
+    TraceScope(const char* _name){
+        if (_name != NULL && is_tracing_enabled()){
+            name = _name;
+            start = get_trace_time();
+        }
+    }
+
+    ~TraceScope(){
+        if (name == NULL)
+            return;
+        double end = get_trace_time();
+        TraceBuffer &buffer = get_thread_trace_buffer();
+        lock_guard < mutex > guard(buffer.buffer_mutex);
+        buffer.events.push_back(TraceEvent{ name, buffer.thread_id, start, end - start });
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+#endif /* Trace_h */
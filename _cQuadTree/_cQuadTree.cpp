@@ -25,14 +25,70 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 #include <vector>
 #include <tuple>
 #include <Point.h>
 #include <QuadTree.h>
+#include <Histogram.h>
+#include <Integrator.h>
+#include <InteractionListCache.h>
+#include <DistanceSampling.h>
+#include <PersistentQuadTree.h>
+#include <KernelDensity.h>
+#include <FastMultipoleMethod.h>
+#include <NeighborPairs.h>
+#include <Trace.h>
 
 using namespace std;
 namespace py = pybind11;
 
+// check that an array has shape (n, 2) and return n, takes the
+// untyped base class such that arrays with any flags can be passed
+inline size_t get_number_of_rows_of_pairs(const py::array &array, const string &name){
+    if (array.ndim() != 2 || array.shape(1) != 2)
+        throw invalid_argument(name + " must have shape (n, 2)");
+    return (size_t) array.shape(0);
+}
+
+// convert an array of shape (n, 2) to a list of points
+inline vector < Point > as_points(const py::array_t < double, py::array::c_style | py::array::forcecast > &array,
+                                  const string &name = "positions"){
+    size_t n = get_number_of_rows_of_pairs(array, name);
+    TraceScope scope("convert");
+    const double* data = array.data();
+    vector < Point > points;
+    points.reserve(n);
+    for(size_t i = 0; i < n; ++i)
+        points.push_back(Point(data[2*i], data[2*i+1]));
+    return points;
+}
+
+// hand the data of a vector over to a NumPy array without copying it,
+// the array takes ownership of the data
+template < typename T >
+py::array_t < T > as_pyarray(vector < T > &&data){
+    TraceScope scope("materialize");
+    auto* owned_data = new vector < T >(move(data));
+    py::capsule owner(owned_data, [](void* ptr){
+        delete reinterpret_cast < vector < T >* >(ptr);
+    });
+    return py::array_t < T >(owned_data->size(), owned_data->data(), owner);
+}
+
+// same as above, but interpret the data as a C-contiguous
+// 2D array with `n_columns` columns
+template < typename T >
+py::array_t < T > as_pyarray(vector < T > &&data, size_t n_columns){
+    TraceScope scope("materialize");
+    auto* owned_data = new vector < T >(move(data));
+    py::capsule owner(owned_data, [](void* ptr){
+        delete reinterpret_cast < vector < T >* >(ptr);
+    });
+    vector < size_t > shape = { owned_data->size() / n_columns, n_columns };
+    return py::array_t < T >(shape, owned_data->data(), owner);
+}
+
 PYBIND11_MODULE(_cQuadTree, m)
 {
     m.doc() = R"pbdoc(
@@ -49,6 +105,10 @@ PYBIND11_MODULE(_cQuadTree, m)
             QuadTree
             Extent
             Point
+            Integrator
+            InteractionListCache
+            VersionedQuadTree
+            QuadTreeSnapshot
 
     )pbdoc";
 
@@ -83,29 +143,177 @@ PYBIND11_MODULE(_cQuadTree, m)
         .def("h", &Extent::height)
     ;
 
-    py::class_<QuadTree>(m, "QuadTree", R"pbdoc(A QuadTree.)pbdoc")
+    m.def("get_extent_of_binary_file", &get_extent_of_binary_file,
+            py::arg("filename"),
+            py::arg("chunk_size") = 1048576,
+            py::arg("force_square") = true,
+        R"pbdoc(
+        Find the bounding box of all positions in a binary file
+        of interleaved (x, y)-pairs of 64-bit floats (e.g. written with
+        ``numpy.ndarray.tofile``), reading only ``chunk_size``
+        positions at a time.
+
+        Parameters
+        ----------
+        filename : str
+            Path to the binary file
+        chunk_size : int, default = 1048576
+            Number of positions that are held in memory at once
+        force_square : bool, default = True
+            Whether or not to force the extent into a square geometry
+
+        Returns
+        -------
+        extent : Extent
+            The bounding box of all positions in the file
+    )pbdoc");
+
+    m.def("weighted_histogram",
+            [](py::array_t < double, py::array::c_style | py::array::forcecast > data,
+               py::array_t < int64_t, py::array::c_style | py::array::forcecast > counts,
+               const vector < double > &bin_edges,
+               size_t n_threads
+              )
+            {
+                if (data.size() != counts.size())
+                    throw length_error("data and counts must be of equal length");
+                HistogramBins bins(bin_edges);
+                return as_pyarray(weighted_histogram(data.data(),
+                                                     counts.data(),
+                                                     (size_t) data.size(),
+                                                     bins,
+                                                     n_threads));
+            },
+            py::arg("data"),
+            py::arg("counts"),
+            py::arg("bin_edges"),
+            py::arg("n_threads") = 0,
+        R"pbdoc(
+        Sum up the counts of distance-count data in bins. A value ``x``
+        falls into bin ``b`` if ``bin_edges[b] < x <= bin_edges[b+1]``
+        (the convention of ``numpy.searchsorted``), values outside
+        of the bins are ignored. Uniformly and logarithmically spaced
+        bin edges are looked up in constant time, other edges by
+        binary search.
+
+        Parameters
+        ----------
+        data : numpy.ndarray of float
+            Distances
+        counts : numpy.ndarray of int
+            Corresponding counts of distances in ``data``.
+        bin_edges : numpy.ndarray of float
+            Edges of the bins
+        n_threads : int, default = 0
+            Number of threads to use, 0 means all available cores.
+
+        Returns
+        -------
+        counts : numpy.ndarray of int
+            Summed counts per bin, of length ``len(bin_edges)-1``.
+    )pbdoc");
+
+    m.def("enable_tracing", &enable_tracing,
+            py::arg("enabled") = true,
+        R"pbdoc(
+        Switch the timing of pipeline phases on or off. While tracing is on,
+        every thread records spans of the phases it runs: ``convert``
+        (turning Python input into native data), ``insert``, ``aggregate``,
+        ``refit``, ``refine`` (splitting up lazy buckets), ``traverse``
+        (queries, one span per thread), ``materialize`` (turning results
+        into NumPy arrays), and the phases of the Fast Multipole Method.
+        Conversions of Python lists that pybind11 does before a method is
+        entered are not covered. When tracing is off, the overhead is
+        negligible.
+
+        Parameters
+        ----------
+        enabled : bool, default = True
+            Whether or not to record spans
+    )pbdoc");
+
+    m.def("is_tracing_enabled", &is_tracing_enabled,
+            "Whether or not spans of pipeline phases are recorded (see :func:`enable_tracing`).");
+
+    m.def("clear_trace", &clear_trace,
+            "Discard all recorded spans, along with the span buffers of threads that have exited.");
+
+    m.def("get_trace_events",
+            []()
+            {
+                py::list events;
+                for(auto const &event: get_trace_events())
+                    events.append(py::make_tuple(string(event.name),
+                                                 event.thread_id,
+                                                 event.start,
+                                                 event.duration));
+                return events;
+            },
+        R"pbdoc(
+        Get all recorded spans.
+
+        Returns
+        -------
+        events : list of 4-tuple of str, int, float, float
+            For every span, the name of the phase, the id of the thread
+            that recorded it, and its start and duration in microseconds.
+    )pbdoc");
+
+    m.def("get_chrome_trace", &get_chrome_trace,
+        R"pbdoc(
+        Get all recorded spans as a JSON string in the Chrome trace-event
+        format, which can be loaded into ``chrome://tracing`` or Perfetto
+        (see :func:`cQuadTree.write_chrome_trace`).
+    )pbdoc");
+
+    py::class_<QuadTree>(m, "QuadTree", R"pbdoc(
+            A QuadTree.
+
+            Queries (e.g. ``compute_force``, ``get_distances_to``,
+            ``compute_quantities``, ``export_arrays``) do not change the tree's
+            points and release the GIL, such that several Python threads can
+            query the same tree in parallel (in lazy trees, queries split up
+            buckets, one thread at a time per bucket). This is safe as long as
+            no thread modifies the tree (e.g. with ``insert`` or ``refit``)
+            at the same time.
+        )pbdoc")
         .def(py::init<>(),"Initialize an empty tree.")
+        .def(py::init<const Extent &>(),
+             py::arg("geom"),
+             "Initialize an empty tree that covers a given root extent (to be filled with `insert` or `insert_positions`).")
         .def(py::init< vector < pair < double, double > > &,
+                       bool const &,
+                       bool const &,
                        bool const &
                      >(),
              py::arg("position_pairs"/*, "List of 2-Tuples containing (x, y)-positions"*/),
              py::arg("force_square"/*, "Whether or not to force the tree into a square geometry")*/) = true,
-             "Initialize a tree given a list of positions.")
+             py::arg("compressed"/*, "Whether or not to collapse chains of nodes with a single occupied quadrant"*/) = false,
+             py::arg("lazy"/*, "Whether or not to build subtrees only when queries need them"*/) = false,
+             "Initialize a tree given a list of positions. With ``lazy=True``, points are kept in buckets that are only split up when a query looks into them (see :meth:`insert_positions_lazily`).")
         .def(py::init< vector < pair < double, double > > &,
                        vector < double > &,
+                       bool const &,
+                       bool const &,
                        bool const &
                      >(),
              py::arg("position_pairs"/*, "List of 2-Tuples containing (x, y)-positions"*/),
              py::arg("masses"/*, "List of masses corresponding to the positions"*/),
              py::arg("force_square"/*, "Whether or not to force the tree into a square geometry")*/) = true,
+             py::arg("compressed"/*, "Whether or not to collapse chains of nodes with a single occupied quadrant"*/) = false,
+             py::arg("lazy"/*, "Whether or not to build subtrees only when queries need them"*/) = false,
              "Initialize a tree given a list of positions and a list of corresponding masses.")
         .def("__repr__", &QuadTree::tostr, R"pbdoc(Get string representation of object)pbdoc")
         .def("__str__", &QuadTree::str, R"pbdoc(Get a string representation of the full tree)pbdoc")
-        .def("get_subtrees", &QuadTree::get_subtrees, R"pbdoc(Get a list of all of this node's children that contain data.)pbdoc",py::return_value_policy::reference)
-        .def("get_subtree", &QuadTree::get_subtree, R"pbdoc(Get subtree 0<=i<=3.)pbdoc",py::return_value_policy::reference)
+        .def("get_subtrees", [](QuadTree &self){ return self.get_subtrees(); },
+                R"pbdoc(Get a list of all of this node's children that contain data.)pbdoc",py::return_value_policy::reference)
+        .def("get_subtree", [](QuadTree &self, int i){ return self.get_subtree(i); },
+                py::arg("i"),
+                R"pbdoc(Get subtree 0<=i<=3.)pbdoc",py::return_value_policy::reference)
         .def("compute_force", &QuadTree::compute_force_on_pair,
                 py::arg("point"),
                 py::arg("theta")=0.5,
+                py::call_guard<py::gil_scoped_release>(),
             R"pbdoc(
             Compute the force on a single point using the Barnes-Hut-Algorithm
             with cutoff parameter :math:`\theta`.
@@ -126,11 +334,117 @@ PYBIND11_MODULE(_cQuadTree, m)
             force : 2-tuple of float
                 Evaluated force vector
         )pbdoc")
+        .def("compute_quantities",
+                [](const QuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > points,
+                   double theta,
+                   double radius,
+                   bool force,
+                   bool potential,
+                   bool mass_within_radius,
+                   bool number_of_interactions,
+                   size_t n_threads,
+                   bool hilbert_order
+                  )
+                {
+                    vector < Point > positions = as_points(points, "points");
+                    int quantities = (force ? _FORCE : 0)
+                                   | (potential ? _POTENTIAL : 0)
+                                   | (mass_within_radius ? _MASS_WITHIN_RADIUS : 0)
+                                   | (number_of_interactions ? _NUMBER_OF_INTERACTIONS : 0);
+
+                    vector < PointQuantities > results;
+                    {
+                        py::gil_scoped_release release;
+                        self.compute_quantities_for_positions(positions, results, quantities,
+                                                              theta, radius, n_threads, hilbert_order);
+                    }
+
+                    size_t n = results.size();
+                    py::dict output;
+                    if (force){
+                        vector < double > forces(2*n);
+                        for(size_t i = 0; i < n; ++i){
+                            forces[2*i] = results[i].force.x;
+                            forces[2*i+1] = results[i].force.y;
+                        }
+                        output["force"] = as_pyarray(move(forces), 2);
+                    }
+                    if (potential){
+                        vector < double > potentials(n);
+                        for(size_t i = 0; i < n; ++i)
+                            potentials[i] = results[i].potential;
+                        output["potential"] = as_pyarray(move(potentials));
+                    }
+                    if (mass_within_radius){
+                        vector < double > masses(n);
+                        for(size_t i = 0; i < n; ++i)
+                            masses[i] = results[i].mass_within_radius;
+                        output["mass_within_radius"] = as_pyarray(move(masses));
+                    }
+                    if (number_of_interactions){
+                        vector < size_t > interactions(n);
+                        for(size_t i = 0; i < n; ++i)
+                            interactions[i] = results[i].number_of_interactions;
+                        output["number_of_interactions"] = as_pyarray(move(interactions));
+                    }
+                    return output;
+                },
+                py::arg("points"),
+                py::arg("theta") = 0.5,
+                py::arg("radius") = 0.0,
+                py::arg("force") = true,
+                py::arg("potential") = true,
+                py::arg("mass_within_radius") = false,
+                py::arg("number_of_interactions") = false,
+                py::arg("n_threads") = 0,
+                py::arg("hilbert_order") = true,
+            R"pbdoc(
+            Compute several quantities for a list of query points in a single
+            traversal of the tree per point, using the Barnes-Hut-Algorithm
+            with cutoff parameter :math:`\theta`. Query points are evaluated in parallel.
+
+            Parameters
+            ----------
+            points : numpy.ndarray of float, shape (n, 2)
+                Query points
+            theta : float, default = 0.5
+                If the distance between the point and the current internal node's
+                center of mass is smaller than :math:`\theta` times the diameter
+                of the internal node's extent (box), the algorithm will treat
+                all children of this node as a giant point mass located at the
+                center of mass of this internal node.
+            radius : float, default = 0.0
+                Radius within which ``mass_within_radius`` is accumulated
+            force : bool, default = True
+                Compute the force vector :math:`\sum_j m_j \mathbf{d}_j/|\mathbf{d}_j|^3`
+            potential : bool, default = True
+                Compute the potential :math:`-\sum_j m_j/|\mathbf{d}_j|`
+            mass_within_radius : bool, default = False
+                Compute the total mass of all interacting points and clusters
+                whose (center of mass) distance is at most ``radius``,
+                including points at zero distance (a local density estimate)
+            number_of_interactions : bool, default = False
+                Count the leaves and internal nodes the query interacted with
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+            hilbert_order : bool, default = True
+                Process the query points sorted along a Hilbert curve over
+                the tree's extent, such that consecutive queries open the
+                same nodes. Results are returned in the order of ``points``.
+
+            Returns
+            -------
+            quantities : dict of numpy.ndarray
+                Contains an entry for every requested quantity, ``force`` has
+                shape ``(n, 2)``, all other entries have length ``n``.
+        )pbdoc")
         .def("get_distances_to", &QuadTree::get_distances_to_pair,
                 py::arg("point"),
                 py::arg("theta") = 0.2,
                 py::arg("ignore_zero_distance") = true,
-                py::arg("tree") = (QuadTree*) nullptr,
+                py::arg("tree") = (const QuadTree*) nullptr,
+                py::call_guard<py::gil_scoped_release>(),
             R"pbdoc(
             Compute distances of point masses and mass clusters to a single point 
             using the Barnes-Hut-Algorithm with cutoff parameter :math:`\theta`.
@@ -171,7 +485,8 @@ PYBIND11_MODULE(_cQuadTree, m)
                 py::arg("points"),
                 py::arg("theta") = 0.2,
                 py::arg("ignore_zero_distance") = true,
-                py::arg("tree") = (QuadTree*) nullptr,
+                py::arg("tree") = (const QuadTree*) nullptr,
+                py::call_guard<py::gil_scoped_release>(),
             R"pbdoc(
             Compute distances of point masses and mass clusters to a list of points
             using the Barnes-Hut-Algorithm with cutoff parameter :math:`\theta`.
@@ -208,9 +523,75 @@ PYBIND11_MODULE(_cQuadTree, m)
                         ...
                     ]
         )pbdoc")
+        .def("get_distances_to_points_csr", 
+                [](const QuadTree &self,
+                   const vector < pair < double, double > > &points,
+                   const double &theta,
+                   const bool &ignore_zero_distance,
+                   size_t n_threads,
+                   bool hilbert_order
+                  )
+                {
+                    vector < size_t > offsets;
+                    vector < double > distances;
+                    vector < size_t > counts;
+                    {
+                        py::gil_scoped_release release;
+                        self.get_distances_to_pairs_csr(points, offsets, distances, counts,
+                                                        theta, ignore_zero_distance, n_threads,
+                                                        hilbert_order);
+                    }
+                    return py::make_tuple(as_pyarray(move(offsets)),
+                                          as_pyarray(move(distances)),
+                                          as_pyarray(move(counts)));
+                },
+                py::arg("points"),
+                py::arg("theta") = 0.2,
+                py::arg("ignore_zero_distance") = true,
+                py::arg("n_threads") = 0,
+                py::arg("hilbert_order") = true,
+            R"pbdoc(
+            Compute distances of point masses and mass clusters to a list of points
+            using the Barnes-Hut-Algorithm with cutoff parameter :math:`\theta`,
+            keeping track of which query point every distance belongs to.
+            Queries are evaluated in parallel.
+
+            Parameters
+            ----------
+            points : list of 2-tuple of float
+                List of points in the plane to which to measure the distances
+            theta : float, default = 0.2
+                If the distance between the point and the current internal node's
+                center of mass is smaller than :math:`\theta` times the diameter
+                of the internal node's extent (box), the algorithm will treat
+                all children of this node as a giant point mass located at the
+                center of mass of this internal node.
+            ignore_zero_distance : bool, default = True
+                If the distance is zero, do or do not include this result in 
+                the result arrays.
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+            hilbert_order : bool, default = True
+                Process the query points sorted along a Hilbert curve over
+                the tree's extent, such that consecutive queries open the
+                same nodes. Results are returned in the order of ``points``.
+
+            Returns
+            -------
+            offsets : numpy.ndarray of int
+                Array of length ``len(points)+1``. The results of query
+                point ``i`` are stored in ``distances[offsets[i]:offsets[i+1]]``
+                and ``counts[offsets[i]:offsets[i+1]]``.
+            distances : numpy.ndarray of float
+                Distances to the query points
+            counts : numpy.ndarray of int
+                Number of points that lie at the corresponding approximate
+                distance to the query point
+        )pbdoc")
         .def("get_pairwise_distances", &QuadTree::_get_pairwise_distances,
                 py::arg("theta") = 0.2,
                 py::arg("ignore_zero_distance") = true,
+                py::call_guard<py::gil_scoped_release>(),
             R"pbdoc(
             Compute distances between pairs of points and point clusters 
             of a tree using the Barnes-Hut-Algorithm with cutoff parameter
@@ -250,7 +631,659 @@ PYBIND11_MODULE(_cQuadTree, m)
                         ...
                     ]
         )pbdoc")
-        .def("is_leaf", &QuadTree::is_leaf, "Whether or not this node is a leaf.")
+        .def("estimate_distance_histogram",
+                [](const QuadTree &self,
+                   const vector < double > &bin_edges,
+                   size_t sample_budget,
+                   double theta,
+                   size_t number_of_strata,
+                   unsigned int seed,
+                   size_t n_threads
+                  )
+                {
+                    DistanceHistogramEstimate estimate;
+                    {
+                        py::gil_scoped_release release;
+                        estimate = estimate_distance_histogram(self, bin_edges, sample_budget, theta,
+                                                               number_of_strata, seed, n_threads);
+                    }
+                    return py::make_tuple(as_pyarray(move(estimate.histogram)),
+                                          as_pyarray(move(estimate.variance)));
+                },
+                py::arg("bin_edges"),
+                py::arg("sample_budget") = 1000,
+                py::arg("theta") = 0.2,
+                py::arg("number_of_strata") = 0,
+                py::arg("seed") = 0,
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Estimate the histogram of distances between all pairs of points
+            in the tree from a stratified sample of query points. The tree
+            is cut into strata (subtrees), query points are drawn without
+            replacement from every stratum proportionally to its number of
+            points, and the distances of every query point to all points are
+            computed with the Barnes-Hut-Algorithm. The cost scales with
+            ``sample_budget``, not with the number of points in the tree.
+            If ``sample_budget`` is at least the number of points, every
+            point is evaluated once, such that the result equals the
+            histogram of all distance queries and the variance is zero.
+            In periodic trees, minimum-image distances are counted.
+
+            Parameters
+            ----------
+            bin_edges : numpy.ndarray of float
+                Edges of the histogram's bins
+            sample_budget : int, default = 1000
+                Largest number of query points to evaluate (at least one
+                is drawn per stratum)
+            theta : float, default = 0.2
+                Barnes-Hut cutoff parameter of the distance queries
+            number_of_strata : int, default = 0
+                Largest number of strata, 0 means ``sample_budget/4``
+                (small subtrees are merged with their neighbors until there
+                are no more strata than that)
+            seed : int, default = 0
+                Seed of the random number generators
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            histogram : numpy.ndarray of float
+                Estimated number of ordered point pairs per bin
+            variance : numpy.ndarray of float
+                Estimated sampling variance of the histogram entries,
+                including the finite population correction (the error
+                of the Barnes-Hut approximation is not included)
+        )pbdoc")
+        .def("kernel_density",
+                [](const QuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > points,
+                   double bandwidth,
+                   const string &kernel,
+                   double atol,
+                   double rtol,
+                   size_t n_threads
+                  )
+                {
+                    Kernel _kernel(kernel, bandwidth);
+                    vector < Point > positions = as_points(points, "points");
+                    vector < double > density(positions.size());
+                    {
+                        py::gil_scoped_release release;
+                        kernel_density(self, positions, density.data(), _kernel, atol, rtol, n_threads);
+                    }
+                    return as_pyarray(move(density));
+                },
+                py::arg("points"),
+                py::arg("bandwidth"),
+                py::arg("kernel") = "gaussian",
+                py::arg("atol") = 0.0,
+                py::arg("rtol") = 1e-2,
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Estimate the density of the tree's points (weighted by mass) at
+            a list of query points with a kernel density estimate,
+            :math:`\hat f(\mathbf{x}) = \sum_j m_j K_h(|\mathbf{x}-\mathbf{x}_j|)/\sum_j m_j`.
+            The contribution of a node is approximated if the bounds of its
+            kernel values (from the node's minimum and maximum distance) are
+            tight enough, such that the error of every estimate is at most
+            ``atol + rtol * density``. Query points are evaluated in parallel.
+
+            Parameters
+            ----------
+            points : numpy.ndarray of float, shape (n, 2)
+                Query points
+            bandwidth : float
+                Bandwidth :math:`h` of the kernel
+            kernel : str, default = 'gaussian'
+                Either ``'gaussian'``, :math:`K_h(r)\propto\exp(-r^2/2h^2)`, or
+                ``'epanechnikov'``, :math:`K_h(r)\propto\max(0, 1-r^2/h^2)`.
+                Both are normalized to integrate to one over the plane.
+            atol : float, default = 0.0
+                Absolute error tolerance of the density
+            rtol : float, default = 0.01
+                Relative error tolerance of the density
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            density : numpy.ndarray of float
+                Estimated density at every query point
+
+            Raises
+            ------
+            RuntimeError
+                If the tree is periodic
+        )pbdoc")
+        .def("kernel_density_on_grid",
+                [](const QuadTree &self,
+                   const Extent &geom,
+                   size_t nx,
+                   size_t ny,
+                   double bandwidth,
+                   const string &kernel,
+                   double atol,
+                   double rtol,
+                   size_t n_threads
+                  )
+                {
+                    Kernel _kernel(kernel, bandwidth);
+                    vector < double > density(nx*ny);
+                    {
+                        py::gil_scoped_release release;
+                        kernel_density_on_grid(self, geom, nx, ny, density.data(), _kernel,
+                                               atol, rtol, n_threads);
+                    }
+                    return as_pyarray(move(density), nx);
+                },
+                py::arg("geom"),
+                py::arg("nx"),
+                py::arg("ny"),
+                py::arg("bandwidth"),
+                py::arg("kernel") = "gaussian",
+                py::arg("atol") = 0.0,
+                py::arg("rtol") = 1e-2,
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Estimate the density of the tree's points on a regular grid,
+            e.g. for heatmaps (see :meth:`kernel_density`). Grid points lie
+            at the centers of the ``nx`` x ``ny`` cells of ``geom``. Tiles
+            of neighboring grid points are traversed together, such that
+            nodes that can be approximated for a whole tile are evaluated
+            only once.
+
+            Parameters
+            ----------
+            geom : Extent
+                Area covered by the grid
+            nx : int
+                Number of grid cells in x-direction
+            ny : int
+                Number of grid cells in y-direction
+            bandwidth : float
+                Bandwidth :math:`h` of the kernel
+            kernel : str, default = 'gaussian'
+                Either ``'gaussian'`` or ``'epanechnikov'``
+            atol : float, default = 0.0
+                Absolute error tolerance of the density
+            rtol : float, default = 0.01
+                Relative error tolerance of the density
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            density : numpy.ndarray of float, shape (ny, nx)
+                Estimated density, ``density[iy, ix]`` belongs to the grid
+                point in row ``iy`` (y-direction) and column ``ix``.
+
+            Raises
+            ------
+            RuntimeError
+                If the tree is periodic
+        )pbdoc")
+        .def("compute_fmm",
+                [](const QuadTree &self,
+                   size_t order,
+                   double theta,
+                   size_t n_threads
+                  )
+                {
+                    vector < double > forces;
+                    vector < double > potentials;
+                    {
+                        py::gil_scoped_release release;
+                        FastMultipoleMethod fmm(order, theta, n_threads);
+                        fmm.compute(self, forces, potentials);
+                    }
+                    return py::make_tuple(as_pyarray(move(forces), 2),
+                                          as_pyarray(move(potentials)));
+                },
+                py::arg("order") = 10,
+                py::arg("theta") = 0.5,
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Compute forces and potentials of all points in the tree with the
+            Fast Multipole Method in time linear in the number of points.
+
+            In contrast to :meth:`compute_force`, this evaluates the 2D
+            Newtonian interaction, i.e. the potential
+            :math:`\phi(x)=\sum_j m_j\log|x-x_j|` and the force
+            :math:`F(x)=\sum_j m_j (x_j-x)/|x_j-x|^2`, which is what the
+            complex-variable expansions of the method apply to. Every phase
+            runs in parallel.
+
+            Parameters
+            ----------
+            order : int, default = 10
+                Number of terms of the multipole and local expansions,
+                the error decreases like ``theta**order``.
+            theta : float, default = 0.5
+                Two cells interact through their expansions if the sum of
+                their radii is smaller than ``theta`` times the distance of
+                their centers. Has to lie in (0, 1).
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            forces : numpy.ndarray of float, shape (n, 2)
+                Force on every point, row ``i`` belongs to the point with
+                id ``i``, ``n`` is the largest id plus one. Rows of ids
+                that aren't in the tree are zero.
+            potentials : numpy.ndarray of float, shape (n,)
+                Potential at every point.
+
+            Raises
+            ------
+            ValueError
+                If a point has a negative id, if two points have the same
+                id, or if the largest id exceeds four times the number of
+                points (and 2**20), which would allocate mostly empty rows
+            RuntimeError
+                If the tree is periodic
+        )pbdoc")
+        .def("get_neighbor_pairs",
+                [](const QuadTree &self,
+                   double radius,
+                   size_t n_threads
+                  )
+                {
+                    vector < PointId > pairs;
+                    vector < double > distances;
+                    {
+                        py::gil_scoped_release release;
+                        get_neighbor_pairs(self, radius, pairs, distances, n_threads);
+                    }
+                    return py::make_tuple(as_pyarray(move(pairs), 2),
+                                          as_pyarray(move(distances)));
+                },
+                py::arg("radius"),
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Find all pairs of points in the tree that lie within a distance of
+            ``radius`` of each other, e.g. to build the neighbor list of a
+            particle simulation or the edges of a random geometric graph.
+
+            The search runs over pairs of nodes. Pairs of nodes whose boxes
+            are farther apart than ``radius`` are skipped, pairs of nodes whose
+            boxes lie within ``radius`` as a whole are taken over without
+            looking at single distances, such that the cost is close to linear
+            in the number of points plus the number of pairs. In periodic
+            trees, distances are measured to the closest image.
+
+            Parameters
+            ----------
+            radius : float
+                Largest distance of a pair (inclusive), has to be non-negative.
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            pairs : numpy.ndarray of int, shape (m, 2)
+                The point ids ``i < j`` of every pair. Every pair occurs
+                once, the order of the pairs depends on ``n_threads``.
+            distances : numpy.ndarray of float, shape (m,)
+                The distance of every pair.
+        )pbdoc")
+        .def("count_neighbor_pairs",
+                [](const QuadTree &self,
+                   double radius,
+                   size_t n_threads
+                  )
+                {
+                    py::gil_scoped_release release;
+                    return count_neighbor_pairs(self, radius, n_threads);
+                },
+                py::arg("radius"),
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Count the pairs of points in the tree that lie within a distance
+            of ``radius`` of each other, like :meth:`get_neighbor_pairs`,
+            but without materializing them. Pairs of nodes that lie within
+            ``radius`` as a whole are counted from their numbers of points.
+
+            Parameters
+            ----------
+            radius : float
+                Largest distance of a pair (inclusive), has to be non-negative.
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            count : int
+                Number of pairs.
+        )pbdoc")
+        .def("merge", &QuadTree::merge,
+                py::arg("other"),
+            R"pbdoc(
+            Move all points of another tree into this one without re-inserting
+            them one by one, e.g. to combine trees that were built for shards of
+            a data set. Quadrants that are occupied in only one of the trees are
+            taken over as a whole, only colliding leaves are re-inserted, and
+            ``total_mass``, ``center_of_mass``, and ``number_of_contained_points``
+            are updated on the way back up, such that the cost scales with the
+            structure both trees share rather than with the number of points.
+            Compressed trees are merged by re-inserting the points of ``other``.
+
+            The root extents have to be aligned: either equal, or one of them
+            is a cell of the recursive subdivision of the other (e.g. build all
+            shards with ``QuadTree(Extent(...))`` of the same extent). An
+            extent may match its cell up to rounding errors of a few units in
+            the last place, as long as all of its points lie within the exact
+            cell, points are never moved. Periodic trees need equal root
+            extents. Point ids are kept as they are.
+
+            Parameters
+            ----------
+            other : QuadTree
+                The tree to merge into this one, it's empty afterwards
+
+            Raises
+            ------
+            ValueError
+                If the root extents are not aligned, points lie outside of
+                the exact cell of an extent that is only aligned up to
+                rounding errors, one tree is periodic and the other one is
+                not, or periodic trees have different root extents. Neither
+                tree is changed in that case.
+            RuntimeError
+                If one of the trees was refitted (see :meth:`refit`)
+        )pbdoc")
+        .def("set_periodic", &QuadTree::set_periodic,
+                py::arg("periodic") = true,
+            R"pbdoc(
+            Treat the root extent as a periodic box, e.g. for simulations with
+            periodic boundary conditions. Points inserted outside of the box
+            are wrapped into it and :meth:`compute_force`,
+            :meth:`compute_quantities`, the distance queries, and
+            :class:`InteractionListCache` use minimum-image displacements, such
+            that every point interacts with the closest image of every other
+            point. Memory and query time stay those of a single box. Nodes
+            are only approximated as a whole if all of their points share
+            the same closest image. Contributions of farther images are
+            neglected. The root does not grow in periodic mode, points with
+            non-finite coordinates are dropped. :meth:`kernel_density`,
+            :meth:`kernel_density_on_grid`, and :meth:`compute_fmm` don't
+            support periodic trees.
+
+            Call this on the root, preferably before inserting points.
+
+            Parameters
+            ----------
+            periodic : bool, default = True
+                Whether or not the box is periodic
+        )pbdoc")
+        .def("wrap_position",
+                [](const QuadTree &self, const pair < double, double > &pos)
+                {
+                    Point image = self.wrap_position(Point(pos.first, pos.second));
+                    return make_pair(image.x, image.y);
+                },
+                py::arg("point"),
+                "Return the image of a point that lies within the periodic root box.")
+        .def("is_leaf", &QuadTree::is_leaf, "Whether or not this node is a leaf.",
+                py::call_guard<py::gil_scoped_release>())
+        .def("export_arrays", 
+                [](const QuadTree &self)
+                {
+                    TreeArrays arrays;
+                    {
+                        py::gil_scoped_release release;
+                        self.export_arrays(arrays);
+                    }
+
+                    py::dict result;
+                    result["left"] = as_pyarray(move(arrays.left));
+                    result["bottom"] = as_pyarray(move(arrays.bottom));
+                    result["width"] = as_pyarray(move(arrays.width));
+                    result["height"] = as_pyarray(move(arrays.height));
+                    result["depth"] = as_pyarray(move(arrays.depth));
+                    result["parent"] = as_pyarray(move(arrays.parent));
+                    result["mass"] = as_pyarray(move(arrays.mass));
+                    result["center_of_mass"] = as_pyarray(move(arrays.center_of_mass), 2);
+                    result["number_of_contained_points"] = as_pyarray(move(arrays.number_of_contained_points));
+                    result["leaf_positions"] = as_pyarray(move(arrays.leaf_positions), 2);
+                    result["leaf_ids"] = as_pyarray(move(arrays.leaf_ids));
+                    result["leaf_nodes"] = as_pyarray(move(arrays.leaf_nodes));
+                    return result;
+                },
+            R"pbdoc(
+            Collect all nodes and leaves of the tree in flat NumPy arrays
+            in a single pass. Nodes are ordered depth-first (pre-order),
+            such that the root has index 0.
+
+            Returns
+            -------
+            arrays : dict of numpy.ndarray
+                Node arrays (one entry per node): ``left``, ``bottom``,
+                ``width``, ``height`` (the node's box), ``depth``,
+                ``parent`` (index of the parent node, -1 for the root),
+                ``mass``, ``center_of_mass`` (shape ``(n_nodes, 2)``),
+                and ``number_of_contained_points``.
+                Leaf arrays (one entry per leaf): ``leaf_positions``
+                (shape ``(n_leaves, 2)``), ``leaf_ids``, and
+                ``leaf_nodes`` (index of the leaf in the node arrays).
+        )pbdoc")
+        .def("insert", &QuadTree::insert_pair,
+                py::arg("point"),
+                py::arg("mass") = 1.0,
+                py::arg("id") = -1,
+                "Insert a single point with a mass and an integer id. If the point lies outside of the root extent, it is ignored unless ``auto_grow`` is set, in which case the root grows to contain it.")
+        .def("insert_positions",
+                [](QuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > positions,
+                   PointId first_id
+                  )
+                {
+                    if (positions.size() == 0)
+                        return;
+                    size_t n = get_number_of_rows_of_pairs(positions, "positions");
+                    const double* data = positions.data();
+                    py::gil_scoped_release release;
+                    self.insert_position_buffer(data, NULL, n, first_id);
+                },
+                py::arg("positions"),
+                py::arg("first_id") = 0,
+            R"pbdoc(
+            Insert a chunk of positions with unit mass. The ids of the points
+            are counted upwards from ``first_id`` such that a large data set
+            can be streamed into a tree with a known root extent chunk by chunk.
+            Points outside of the root extent are ignored unless ``auto_grow``
+            is set, in which case the root grows to contain them.
+
+            A C-contiguous float64 array of shape ``(n, 2)`` (e.g. a slice of
+            a ``numpy.memmap``) is read in place, without copying it.
+            The tree holds every inserted point, so its memory grows linearly
+            with the total number of points.
+
+            Parameters
+            ----------
+            positions : numpy.ndarray of float, shape (n, 2)
+                Positions of the points
+            first_id : int, default = 0
+                Point ``i`` gets the id ``first_id + i`` (64-bit integers)
+
+            Raises
+            ------
+            OverflowError
+                If the ids would exceed the largest 64-bit integer,
+                in which case no point is inserted
+        )pbdoc")
+        .def("insert_positions",
+                [](QuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > positions,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > masses,
+                   PointId first_id
+                  )
+                {
+                    if (positions.size() == 0 && masses.size() == 0)
+                        return;
+                    size_t n = get_number_of_rows_of_pairs(positions, "positions");
+                    if (masses.ndim() != 1 || (size_t) masses.size() != n)
+                        throw length_error("masses and positions must be of equal length");
+                    const double* data = positions.data();
+                    const double* mass_data = masses.data();
+                    py::gil_scoped_release release;
+                    self.insert_position_buffer(data, mass_data, n, first_id);
+                },
+                py::arg("positions"),
+                py::arg("masses"),
+                py::arg("first_id") = 0,
+                "Insert a chunk of positions and corresponding masses, with ids counted upwards from ``first_id``. Arrays are read in place.")
+        .def("insert_positions", &QuadTree::insert_position_pairs,
+                py::arg("position_pairs"),
+                py::arg("first_id") = 0,
+                "Insert a list of position pairs with unit mass, with ids counted upwards from ``first_id``.")
+        .def("insert_positions", &QuadTree::insert_position_pairs_and_masses,
+                py::arg("position_pairs"),
+                py::arg("masses"),
+                py::arg("first_id") = 0,
+                "Insert a chunk of positions and corresponding masses, with ids counted upwards from ``first_id``.")
+        .def("insert_positions_lazily",
+                [](QuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > positions,
+                   const vector < double > &masses,
+                   PointId first_id
+                  )
+                {
+                    vector < Point > _positions = as_points(positions);
+                    py::gil_scoped_release release;
+                    self.insert_positions_lazily(_positions, masses, first_id);
+                },
+                py::arg("positions"),
+                py::arg("masses") = vector < double >(),
+                py::arg("first_id") = 0,
+            R"pbdoc(
+            Insert points into an empty tree without building it. The root
+            becomes a bucket that only knows the total mass and center of
+            mass of its points. A bucket is split up into its quadrants (which
+            become buckets themselves) the first time a query needs to look
+            into it, such that the work of a few local queries scales with
+            the region they touch rather than with the number of points.
+            Queries that visit every node (e.g. :meth:`export_arrays`)
+            build the whole tree. Buckets are split up under a lock, so
+            concurrent queries stay safe.
+
+            Parameters
+            ----------
+            positions : numpy.ndarray of float, shape (N, 2)
+                Positions of the points
+            masses : list of float, default = []
+                Masses of the points, all masses are 1 if empty
+            first_id : int, default = 0
+                Id of the first point, ids are counted upwards
+
+            Raises
+            ------
+            RuntimeError
+                If the tree is not empty or compressed
+        )pbdoc")
+        .def("is_lazy", &QuadTree::is_lazy, "Whether or not this node is a bucket whose points have not been distributed to subtrees yet.")
+        .def("insert_concurrent",
+                [](QuadTree &self, const pair < double, double > &point, double mass, PointId id)
+                {
+                    return self.insert_concurrent(Point(point.first, point.second), mass, id);
+                },
+                py::arg("point"),
+                py::arg("mass") = 1.0,
+                py::arg("id") = -1,
+                py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+            Insert a single point such that several threads can insert into
+            the same tree at the same time (the GIL is released during insertion).
+            The mass aggregates (``total_mass``, ``center_of_mass``,
+            ``number_of_contained_points``) are not updated, call
+            :meth:`update_aggregates` once all threads are done.
+            Do not query the tree or call :meth:`insert` while
+            concurrent insertions are running.
+
+            Returns
+            -------
+            inserted : bool
+                ``False`` if the point lies outside of the root extent
+                (the root does not grow during concurrent insertion).
+        )pbdoc")
+        .def("refit",
+                [](QuadTree &self, py::array_t < double, py::array::c_style | py::array::forcecast > positions)
+                {
+                    vector < Point > _positions = as_points(positions);
+                    py::gil_scoped_release release;
+                    self.refit(_positions);
+                },
+                py::arg("positions"),
+            R"pbdoc(
+            Move every leaf's point to ``positions[this_id]`` and update the
+            mass aggregates, without changing the structure of the tree
+            (such that an :class:`InteractionListCache` can reuse its lists
+            while the points moved less than its ``tolerance``).
+            Boxes are not adapted, so this is meant for points that move
+            only a little. Build a new tree before inserting further points.
+
+            Parameters
+            ----------
+            positions : numpy.ndarray of float, shape (n, 2)
+                New positions of all points, indexed by their ids
+
+            Raises
+            ------
+            IndexError
+                If the id of a point does not refer to a row of
+                ``positions``, in which case no point is moved
+        )pbdoc")
+        .def("update_aggregates", [](QuadTree &self){ self.update_aggregates(); },
+                "Recompute the total mass, center of mass, and number of contained points of all nodes (required after :meth:`insert_concurrent`).")
+        .def("insert_positions_concurrently", &QuadTree::insert_position_pairs_concurrently,
+                py::arg("position_pairs"),
+                py::arg("masses"),
+                py::arg("first_id") = 0,
+                py::arg("n_threads") = 0,
+                py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+            Insert positions and corresponding masses with several threads
+            at once. The root extent grows beforehand to contain all
+            positions (if ``auto_grow`` is set) and the mass aggregates
+            are updated afterwards.
+
+            Parameters
+            ----------
+            position_pairs : list of 2-tuple of float
+                Positions to insert
+            masses : list of float
+                Corresponding masses
+            first_id : int, default = 0
+                The ids of the points are counted upwards from this value
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+        )pbdoc")
+        .def("insert_from_binary_file", &QuadTree::insert_from_binary_file,
+                py::arg("filename"),
+                py::arg("chunk_size") = 1048576,
+                py::arg("first_id") = 0,
+            R"pbdoc(
+            Stream positions from a binary file of interleaved (x, y)-pairs
+            of 64-bit floats (e.g. written with ``numpy.ndarray.tofile``)
+            into the tree, holding only ``chunk_size`` positions in memory
+            at a time. Use with a tree that was initialized with a root extent,
+            e.g. from :func:`get_extent_of_binary_file`. The tree itself
+            holds every point, so its memory grows linearly with the number
+            of points in the file.
+
+            Returns
+            -------
+            number_of_positions : int
+                The number of positions that were read from the file.
+
+            Raises
+            ------
+            OverflowError
+                If the ids of the file's points would exceed the largest
+                64-bit integer, in which case no point is inserted
+        )pbdoc")
 
 
 
@@ -269,6 +1302,261 @@ PYBIND11_MODULE(_cQuadTree, m)
         .def_readwrite("number_of_contained_points", 
                   &QuadTree::number_of_contained_points, "Number of points contained in this internal node.")
         .def_readwrite("parent", &QuadTree::parent, "The parent of this internal node.")
+        .def_readwrite("compressed", &QuadTree::compressed, "Whether or not chains of nodes with a single occupied quadrant are collapsed, such that every internal node's box is the smallest cell that splits its points (set before inserting points, new nodes inherit this from their parent).")
+        .def_readwrite("auto_grow", &QuadTree::auto_grow, "Whether or not the root extent is doubled towards points that are inserted outside of it (otherwise, such points are ignored). Off by default.")
+        .def_readonly("periodic", &QuadTree::periodic, "Whether or not the root extent is a periodic box (see :meth:`set_periodic`).")
+        .def_readonly("box_slack", &QuadTree::box_slack, "The points below this node lie within its box grown by this distance on every side (nonzero only after :meth:`refit`).")
+        .def_readonly("refit_displacement", &QuadTree::refit_displacement, "Sum of the largest distances a point moved in every :meth:`refit` of this tree.")
+    ;
+
+    py::class_<InteractionListCache>(m, "InteractionListCache", R"pbdoc(
+        Caches the nodes the Barnes-Hut algorithm interacts with (interaction lists)
+        for every query point, to be reused across repeated force evaluations.
+        A list is reused as long as ``theta`` and the topology of the tree did
+        not change (e.g. when it was only updated with :meth:`QuadTree.refit`) and the
+        distance the query point moved from the position the list was built
+        for, plus the distance the tree's points moved with :meth:`QuadTree.refit`
+        since then, is at most ``tolerance``. Otherwise, only the invalid lists
+        are rebuilt.
+    )pbdoc")
+        .def(py::init<double, double, size_t>(),
+             py::arg("theta") = 0.5,
+             py::arg("tolerance") = 0.0,
+             py::arg("n_threads") = 0,
+             "Initialize an empty cache.")
+        .def_readwrite("theta", &InteractionListCache::theta, "Barnes-Hut cutoff parameter. Changing it rebuilds all lists in the next call of :meth:`compute_forces`.")
+        .def_readwrite("tolerance", &InteractionListCache::tolerance, "Distance a query point and the tree's points together can move before the query's interaction list is rebuilt.")
+        .def_readwrite("n_threads", &InteractionListCache::n_threads, "Number of threads, 0 means all available cores.")
+        .def_readonly("number_of_rebuilt_lists", &InteractionListCache::number_of_rebuilt_lists, "Number of interaction lists that were rebuilt in the last call of :meth:`compute_forces`.")
+        .def("invalidate", &InteractionListCache::invalidate, "Discard all cached interaction lists.")
+        .def("compute_forces",
+                [](InteractionListCache &self,
+                   const QuadTree &tree,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > positions
+                  )
+                {
+                    vector < Point > _positions = as_points(positions);
+                    vector < double > forces(2*_positions.size());
+                    {
+                        py::gil_scoped_release release;
+                        self.compute_forces(tree, _positions, forces.data());
+                    }
+                    return as_pyarray(move(forces), 2);
+                },
+                py::arg("tree"),
+                py::arg("positions"),
+            R"pbdoc(
+            Compute the forces on all query points, reusing cached
+            interaction lists where possible.
+
+            Parameters
+            ----------
+            tree : QuadTree
+                The tree to evaluate the forces with
+            positions : numpy.ndarray of float, shape (n, 2)
+                Query points
+
+            Returns
+            -------
+            forces : numpy.ndarray of float, shape (n, 2)
+                Evaluated force vectors
+        )pbdoc")
+    ;
+
+    py::class_<Integrator>(m, "Integrator", R"pbdoc(
+        Time integration of point masses with a velocity-Verlet (kick-drift-kick
+        leapfrog) scheme. In every step, a tree is built from the current
+        positions and the accelerations of all points are evaluated in
+        parallel with the Barnes-Hut algorithm.
+    )pbdoc")
+        .def(py::init<>(), "Initialize with default parameters.")
+        .def_readwrite("dt", &Integrator::dt, "Time step.")
+        .def_readwrite("theta", &Integrator::theta, "Barnes-Hut cutoff parameter.")
+        .def_readwrite("coupling", &Integrator::coupling, "The acceleration of a point is ``coupling`` times the force computed by the tree, use negative values for repulsion (e.g. force-directed layouts).")
+        .def_readwrite("damping", &Integrator::damping, "Velocities are multiplied by ``1 - damping`` after every step.")
+        .def_readwrite("max_displacement", &Integrator::max_displacement, "Maximum distance a point can move in a single step, 0 means unlimited.")
+        .def_readwrite("cooling", &Integrator::cooling, "The maximum displacement is multiplied by this factor after every step of a call to ``integrate``, starting from ``max_displacement`` (which itself is left unchanged).")
+        .def_readwrite("n_threads", &Integrator::n_threads, "Number of threads, 0 means all available cores.")
+        .def("integrate",
+                [](Integrator &self,
+                   py::array_t < double, py::array::c_style > positions,
+                   py::array_t < double, py::array::c_style > velocities,
+                   vector < double > masses,
+                   size_t n_steps,
+                   py::object callback,
+                   size_t callback_every
+                  )
+                {
+                    size_t n = get_number_of_rows_of_pairs(positions, "positions");
+                    if (get_number_of_rows_of_pairs(velocities, "velocities") != n)
+                        throw length_error("positions and velocities must be of equal length");
+
+                    if (!positions.writeable() || !velocities.writeable())
+                        throw invalid_argument("positions and velocities must be writeable, they are updated in place");
+
+                    function < bool (size_t) > _callback = nullptr;
+                    if (!callback.is_none())
+                        _callback = [callback](size_t step){
+                            py::gil_scoped_acquire acquire;
+                            py::object result = callback(step);
+                            return result.is_none() || result.cast<bool>();
+                        };
+
+                    double* _positions = positions.mutable_data();
+                    double* _velocities = velocities.mutable_data();
+
+                    py::gil_scoped_release release;
+                    return self.integrate(_positions, _velocities, masses, n,
+                                          n_steps, _callback, callback_every);
+                },
+                // no conversion, otherwise the in-place update would only change a copy
+                py::arg("positions").noconvert(),
+                py::arg("velocities").noconvert(),
+                py::arg("masses"),
+                py::arg("n_steps") = 1,
+                py::arg("callback") = py::none(),
+                py::arg("callback_every") = 1,
+            R"pbdoc(
+            Advance positions and velocities by ``n_steps`` time steps.
+
+            Parameters
+            ----------
+            positions : numpy.ndarray of float, shape (n, 2)
+                Positions of the points, C-contiguous float64, updated in place
+            velocities : numpy.ndarray of float, shape (n, 2)
+                Velocities of the points, C-contiguous float64, updated in place
+            masses : numpy.ndarray of float
+                Masses of the points
+            n_steps : int, default = 1
+                Number of steps
+            callback : callable, default = None
+                Called as ``callback(step)`` after every ``callback_every``
+                steps, e.g. to read out the current positions. If it returns
+                ``False``, the integration stops.
+            callback_every : int, default = 1
+                Number of steps between two calls of ``callback``
+
+            Returns
+            -------
+            steps : int
+                Number of steps that were taken
+
+            Raises
+            ------
+            TypeError
+                If ``positions`` or ``velocities`` are not C-contiguous
+                float64 arrays (they would have to be copied)
+            ValueError
+                If ``positions`` or ``velocities`` are read-only
+        )pbdoc")
+    ;
+
+    py::class_<QuadTreeSnapshot>(m, "QuadTreeSnapshot", R"pbdoc(
+        A read-only version of a :class:`VersionedQuadTree`, obtained with
+        :meth:`VersionedQuadTree.snapshot`. The version never changes,
+        even if points are inserted into the tree afterwards. Queries
+        release the GIL and can be run from several threads at once.
+    )pbdoc")
+        .def_readonly("version", &QuadTreeSnapshot::version, "Number of insertions that led to this version.")
+        .def_readonly("geom", &QuadTreeSnapshot::geom, "Root extent of this version.")
+        .def("number_of_contained_points", &QuadTreeSnapshot::number_of_contained_points,
+                "Number of points in this version.")
+        .def("total_mass", &QuadTreeSnapshot::total_mass,
+                "Total mass of all points in this version.")
+        .def("compute_force", &QuadTreeSnapshot::compute_force_on_pair,
+                py::arg("point"),
+                py::arg("theta") = 0.5,
+                py::call_guard<py::gil_scoped_release>(),
+                "Compute the force on a single point, see :meth:`QuadTree.compute_force`.")
+        .def("compute_forces",
+                [](const QuadTreeSnapshot &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > points,
+                   double theta,
+                   size_t n_threads
+                  )
+                {
+                    vector < Point > positions = as_points(points, "points");
+                    vector < double > forces(2*positions.size());
+                    {
+                        py::gil_scoped_release release;
+                        self.compute_forces(positions, forces.data(), theta, n_threads);
+                    }
+                    return as_pyarray(move(forces), 2);
+                },
+                py::arg("points"),
+                py::arg("theta") = 0.5,
+                py::arg("n_threads") = 0,
+            R"pbdoc(
+            Compute the forces on a list of points in parallel.
+
+            Parameters
+            ----------
+            points : numpy.ndarray of float, shape (n, 2)
+                Query points
+            theta : float, default = 0.5
+                Barnes-Hut cutoff parameter
+            n_threads : int, default = 0
+                Number of threads to use, 0 means all available cores.
+
+            Returns
+            -------
+            forces : numpy.ndarray of float, shape (n, 2)
+                Evaluated force vectors
+        )pbdoc")
+        .def("get_distances_to", &QuadTreeSnapshot::get_distances_to_pair,
+                py::arg("point"),
+                py::arg("theta") = 0.2,
+                py::arg("ignore_zero_distance") = true,
+                py::call_guard<py::gil_scoped_release>(),
+                "Compute distances of points and clusters to a single point, see :meth:`QuadTree.get_distances_to`.")
+    ;
+
+    py::class_<VersionedQuadTree>(m, "VersionedQuadTree", R"pbdoc(
+        A tree with immutable nodes that can be updated while it is queried.
+        Inserting a point copies only the nodes on the path from the root to
+        the point, all other nodes are shared between versions. Readers take
+        cheap snapshots with :meth:`snapshot` and are never blocked by writers.
+        The root extent doubles towards points that are inserted outside of it.
+    )pbdoc")
+        .def(py::init<>(), "Initialize an empty tree with root extent (0, 0, 1, 1).")
+        .def(py::init<const Extent &>(),
+             py::arg("geom"),
+             "Initialize an empty tree with a given root extent.")
+        .def("snapshot", &VersionedQuadTree::snapshot,
+                py::call_guard<py::gil_scoped_release>(),
+                "Get a read-only handle of the current version.")
+        .def("insert", &VersionedQuadTree::insert_pair,
+                py::arg("point"),
+                py::arg("mass") = 1.0,
+                py::arg("id") = -1,
+                py::call_guard<py::gil_scoped_release>(),
+                "Insert a single point and publish a new version. Returns False if the point is not finite.")
+        .def("insert_positions",
+                [](VersionedQuadTree &self,
+                   py::array_t < double, py::array::c_style | py::array::forcecast > positions,
+                   vector < double > masses,
+                   PointId first_id
+                  )
+                {
+                    vector < Point > _positions = as_points(positions);
+                    py::gil_scoped_release release;
+                    self.insert_positions(_positions, masses, first_id);
+                },
+                py::arg("positions"),
+                py::arg("masses") = vector < double >(),
+                py::arg("first_id") = 0,
+            R"pbdoc(
+            Insert a batch of points and publish a single new version afterwards.
+
+            Parameters
+            ----------
+            positions : numpy.ndarray of float, shape (n, 2)
+                Positions of the points
+            masses : list of float, default = []
+                Masses of the points, all masses are 1 if empty
+            first_id : int, default = 0
+                Point ``i`` gets the id ``first_id + i``
+        )pbdoc")
     ;
 
 }
@@ -18,9 +18,23 @@ from _cQuadTree import (
         Point,
         Extent,
         QuadTree,
+        Integrator,
+        InteractionListCache,
+        VersionedQuadTree,
+        QuadTreeSnapshot,
+        get_extent_of_binary_file,
+        enable_tracing,
+        is_tracing_enabled,
+        clear_trace,
+        get_trace_events,
+        get_chrome_trace,
     )
 
 from .utils import (
         histogram,
         get_points_and_boxes,
+        build_tree_from_chunks,
+        estimate_distance_histogram,
+        write_chrome_trace,
+        trace_summary,
     )
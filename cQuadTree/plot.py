@@ -1,3 +1,4 @@
+import numpy as np
 import matplotlib as mpl
 import matplotlib.pyplot as pl
 from matplotlib.collections import PatchCollection
@@ -14,7 +15,9 @@ def plot_boxes(
     """
     Plot a graphical representation of the tree as boxes on a matplotlib.Axes.
 
-    Use with data obtained from :func:`cQuadTree.utils.get_points_and_boxes`.
+    Use with data obtained from :func:`cQuadTree.utils.get_points_and_boxes`,
+    either as a list of :class:`_cQuadTree.Extent` or as an array of shape
+    ``(n_boxes, 4)`` with rows ``(left, bottom, width, height)``.
     """
     if ax is None:
         fig, ax = pl.subplots(1,1,figsize=figsize)
@@ -23,9 +26,13 @@ def plot_boxes(
     pl.axis('square')
 
     rects = []
-    for E in list_of_extents:
-        rect = Rectangle((E.l(), E.b()), E.w(), E.h())
-        rects.append(rect)
+    if isinstance(list_of_extents, np.ndarray):
+        for l, b, w, h in list_of_extents:
+            rects.append(Rectangle((l, b), w, h))
+    else:
+        for E in list_of_extents:
+            rect = Rectangle((E.l(), E.b()), E.w(), E.h())
+            rects.append(rect)
 
     patches = PatchCollection(rects,
                               alpha = alpha,
@@ -60,7 +67,10 @@ def plot_points(
     pl.sca(ax)
     pl.axis('square')
 
-    x, y = zip(*[(P.x, P.y) for P in list_of_points])
+    if isinstance(list_of_points, np.ndarray):
+        x, y = list_of_points[:,0], list_of_points[:,1]
+    else:
+        x, y = zip(*[(P.x, P.y) for P in list_of_points])
 
     ax.plot(x, y, ls='None', marker=marker, color=color, **kwargs)
 
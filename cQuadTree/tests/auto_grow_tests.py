@@ -0,0 +1,137 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, direct_distances
+
+
+class AutoGrowTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(14)
+        self.positions = rng.random((2000, 2))
+        self.outside = np.array([(3.5, 0.5), (-2.25, -7.0), (0.5, 12.0), (40.0, -0.1)])
+        self.queries = np.concatenate([rng.random((20, 2)), 10 * rng.random((10, 2)) - 5])
+
+    def get_tree(self):
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.auto_grow = True
+        T.insert_positions(self.positions.tolist())
+        return T
+
+    def assert_contains(self, T, positions):
+        assert(T.number_of_contained_points == len(positions))
+        assert(np.isclose(T.total_mass, len(positions)))
+        geom = T.geom
+        assert(np.all(positions[:, 0] >= geom.left()) and np.all(positions[:, 0] <= geom.left() + geom.width()))
+        assert(np.all(positions[:, 1] >= geom.bottom()) and np.all(positions[:, 1] <= geom.bottom() + geom.height()))
+
+        # theta = 0 never approximates a node, i.e. sums over all points
+        forces = np.array([ T.compute_force(tuple(q), theta=0.0) for q in self.queries ])
+        assert(np.allclose(forces, direct_forces(self.queries, positions, np.ones(len(positions))), rtol=1e-10))
+        distances = [ d for d, c in T.get_distances_to(tuple(self.queries[0]), theta=0.0) ]
+        assert(np.allclose(np.sort(distances), direct_distances(self.queries[0], positions)))
+
+    def test_grow_towards_points(self):
+
+        T = self.get_tree()
+        positions = self.positions
+        for pos in self.outside:
+            T.insert(tuple(pos))
+            positions = np.concatenate([positions, [pos]])
+            self.assert_contains(T, positions)
+
+        # the root was doubled, so its box is a power of two times the old one
+        assert(T.geom.width() == T.geom.height())
+        assert(np.log2(T.geom.width()) % 1 == 0)
+
+        # the grown tree has the same nodes as a tree built over its extent,
+        # so it approximates the same nodes
+        U = QuadTree(T.geom)
+        U.insert_positions(positions.tolist())
+        for q in self.queries:
+            assert(np.allclose(T.compute_force(tuple(q), theta=0.5), U.compute_force(tuple(q), theta=0.5),
+                               rtol=1e-10, atol=1e-10))
+
+    def test_grow_in_batches(self):
+
+        T = self.get_tree()
+        T.insert_positions(self.outside.tolist(), first_id=len(self.positions))
+        self.assert_contains(T, np.concatenate([self.positions, self.outside]))
+
+    def grow(self, T, positions, first_id):
+        # insert the points one by one, such that the root grows several times
+        T.auto_grow = True
+        for i, pos in enumerate(positions):
+            T.insert(tuple(pos), id=first_id + i)
+
+    def assert_ids(self, T, n):
+        arrays = T.export_arrays()
+        assert(np.array_equal(np.sort(arrays['leaf_ids']), np.arange(n)))
+
+    def test_grow_from_empty(self):
+
+        # neither the tree nor its box have an extent to begin with
+        for compressed in [False, True]:
+            T = QuadTree()
+            T.compressed = compressed
+            self.grow(T, self.positions[:500], 0)
+            self.assert_contains(T, self.positions[:500])
+            self.assert_ids(T, 500)
+
+    def test_grow_from_single_point(self):
+
+        positions = np.concatenate([self.positions[:1], self.outside, self.positions[1:500]])
+        T = QuadTree(positions[:1].tolist())
+        assert(T.geom.width() == 0 and T.geom.height() == 0)
+        self.grow(T, positions[1:], 1)
+        self.assert_contains(T, positions)
+        self.assert_ids(T, len(positions))
+
+    def test_grow_from_points_on_a_line(self):
+
+        # the root box of points on a line has no area, its nodes are kept when it grows
+        rng = np.random.default_rng(15)
+        t = rng.random(300)
+        for line in [np.column_stack([t, np.full(300, 0.25)]), np.column_stack([np.full(300, 0.25), t])]:
+            for compressed in [False, True]:
+                T = QuadTree(line.tolist(), force_square=False, compressed=compressed)
+                assert(T.geom.width() == 0 or T.geom.height() == 0)
+                positions = np.concatenate([line, self.outside, self.positions[:300]])
+                self.grow(T, positions[len(line):], len(line))
+                self.assert_contains(T, positions)
+                self.assert_ids(T, len(positions))
+
+    def test_points_outside_are_ignored_without_auto_grow(self):
+
+        # points outside of the root box are ignored by default
+        T = QuadTree(Extent(0, 0, 1, 1))
+        assert(not T.auto_grow)
+        T.insert((3.5, 0.5))
+        assert(T.number_of_contained_points == 0)
+
+        T = self.get_tree()
+        T.auto_grow = False
+        for pos in self.outside:
+            T.insert(tuple(pos))
+        assert((T.geom.left(), T.geom.bottom(), T.geom.width(), T.geom.height()) == (0, 0, 1, 1))
+        self.assert_contains(T, self.positions)
+
+        # non-finite positions are ignored either way
+        T.auto_grow = True
+        for pos in [(np.nan, 0.5), (np.inf, 0.5)]:
+            T.insert(pos)
+        self.assert_contains(T, self.positions)
+
+
+if __name__ == "__main__":
+
+    T = AutoGrowTest()
+    T.setUp()
+    T.test_grow_towards_points()
+    T.test_grow_in_batches()
+    T.test_grow_from_empty()
+    T.test_grow_from_single_point()
+    T.test_grow_from_points_on_a_line()
+    T.test_points_outside_are_ignored_without_auto_grow()
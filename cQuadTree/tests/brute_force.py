@@ -0,0 +1,84 @@
+"""
+Brute-force references for the tree-based results, shared by the tests.
+"""
+
+import numpy as np
+
+
+def minimum_image(d, period):
+    return d - period * np.round(d / period)
+
+
+def get_displacements(queries, positions, period=None):
+    d = positions[None, :, :] - queries[:, None, :]
+    if period is not None:
+        d = minimum_image(d, period)
+    return d
+
+
+def direct_forces(queries, positions, masses, period=None):
+    # the sum over all points, i.e. a tree query with theta = 0,
+    # points at zero distance don't contribute
+    d = get_displacements(queries, positions, period)
+    r = np.linalg.norm(d, axis=2)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        w = np.where(r > 0, masses[None, :] / r**3, 0.0)
+    return (w[:, :, None] * d).sum(axis=1)
+
+
+def direct_potentials(queries, positions, masses):
+    r = np.linalg.norm(get_displacements(queries, positions), axis=2)
+    with np.errstate(divide='ignore'):
+        return -np.where(r > 0, masses[None, :] / r, 0.0).sum(axis=1)
+
+
+def direct_distances(query, positions, period=None):
+    # sorted distances of all points to a single query point,
+    # zero distances are ignored like in the tree queries
+    d = get_displacements(np.array([query]), positions, period)[0]
+    r = np.linalg.norm(d, axis=1)
+    return np.sort(r[r > 0])
+
+
+def assert_equal_trees(A, B):
+    # same nodes and leaves, aggregates up to the order of summation
+    a = A.export_arrays()
+    b = B.export_arrays()
+    for key in ['left', 'bottom', 'width', 'height', 'depth', 'parent',
+                'number_of_contained_points', 'leaf_positions', 'leaf_ids', 'leaf_nodes']:
+        assert(np.array_equal(a[key], b[key]))
+    assert(np.allclose(a['mass'], b['mass'], rtol=1e-12))
+    assert(np.allclose(a['center_of_mass'], b['center_of_mass'], rtol=1e-12))
+
+
+def direct_density(queries, positions, masses, bandwidth, kernel):
+    r2 = ((queries[:, None, :] - positions[None, :, :])**2).sum(axis=2) / bandwidth**2
+    if kernel == 'gaussian':
+        K = np.exp(-0.5 * r2) / (2 * np.pi * bandwidth**2)
+    else:
+        K = np.maximum(1 - r2, 0) * 2 / (np.pi * bandwidth**2)
+    return (K * masses[None, :]).sum(axis=1) / masses.sum()
+
+
+def direct_log_forces_and_potentials(positions, masses):
+    # the 2D kernel of the Fast Multipole Method, force d/r^2
+    # and potential log(r), summed over all other points
+    d = positions[None, :, :] - positions[:, None, :]
+    r2 = (d**2).sum(axis=2)
+    np.fill_diagonal(r2, 1.0)
+    w = masses[None, :] / r2
+    np.fill_diagonal(w, 0.0)
+    forces = (w[:, :, None] * d).sum(axis=1)
+    logs = 0.5 * np.log(r2)
+    np.fill_diagonal(logs, 0.0)
+    potentials = (masses[None, :] * logs).sum(axis=1)
+    return forces, potentials
+
+
+def brute_force_pairs(positions, radius, period=None):
+    # all pairs i < j within `radius`, and the matrix of distances
+    d = get_displacements(positions, positions, period)
+    r = np.linalg.norm(d, axis=2)
+    i, j = np.triu_indices(len(positions), k=1)
+    close = r[i, j] <= radius
+    return set(zip(i[close].tolist(), j[close].tolist())), r
@@ -0,0 +1,77 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, direct_distances
+
+
+class CompressedTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(18)
+        # tight clusters produce long chains of nodes with a single occupied quadrant
+        self.positions = np.concatenate([0.3 + 1e-6 * rng.random((300, 2)),
+                                         0.71 + 1e-4 * rng.random((300, 2)),
+                                         rng.random((1400, 2))])
+        self.masses = 0.5 + rng.random(len(self.positions))
+        self.queries = rng.random((40, 2))
+
+    def get_trees(self):
+        trees = []
+        for compressed in [False, True]:
+            T = QuadTree(Extent(0, 0, 1, 1))
+            T.compressed = compressed
+            T.insert_positions(self.positions.tolist(), self.masses.tolist())
+            trees.append(T)
+        return trees
+
+    def test_same_results_as_plain_tree(self):
+
+        plain, compressed = self.get_trees()
+        assert(compressed.number_of_contained_points == plain.number_of_contained_points)
+        assert(np.isclose(compressed.total_mass, plain.total_mass, rtol=1e-12))
+
+        expected = direct_forces(self.queries, self.positions, self.masses)
+        for T in [plain, compressed]:
+            # theta = 0 never approximates a node, i.e. sums over all points
+            forces = np.array([ T.compute_force(tuple(q), theta=0.0) for q in self.queries ])
+            assert(np.allclose(forces, expected, rtol=1e-10))
+
+            forces = np.array([ T.compute_force(tuple(q), theta=0.5) for q in self.queries ])
+            error = np.linalg.norm(forces - expected, axis=1)
+            assert(np.all(error <= 1e-2 * np.linalg.norm(expected, axis=1)))
+
+        for q in self.queries[::5]:
+            q = tuple(q)
+            a = compressed.get_distances_to(q, theta=0.0)
+            assert(np.allclose(np.sort([ d for d, c in a ]), direct_distances(q, self.positions)))
+            # with approximations, every point is still counted exactly once
+            assert(sum(c for d, c in compressed.get_distances_to(q, theta=0.5)) == len(self.positions))
+
+    def test_chains_are_collapsed(self):
+
+        plain, compressed = self.get_trees()
+        a = plain.export_arrays()
+        b = compressed.export_arrays()
+
+        # the same leaves, but fewer nodes
+        for arrays in [a, b]:
+            order = np.argsort(arrays['leaf_ids'])
+            assert(np.array_equal(arrays['leaf_ids'][order], np.arange(len(self.positions))))
+            assert(np.array_equal(arrays['leaf_positions'][order], self.positions))
+        assert(len(b['left']) < len(a['left']))
+        assert(len(b['left']) < 2 * len(self.positions))
+
+        # every internal node splits its points
+        children = np.bincount(b['parent'][1:], minlength=len(b['left']))
+        internal = np.setdiff1d(np.arange(len(b['left'])), b['leaf_nodes'])
+        assert(np.all(children[internal] >= 2))
+
+
+if __name__ == "__main__":
+
+    T = CompressedTest()
+    T.setUp()
+    T.test_same_results_as_plain_tree()
+    T.test_chains_are_collapsed()
@@ -0,0 +1,54 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, assert_equal_trees
+
+
+class ConcurrentInsertionTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(1)
+        self.positions = rng.random((5000, 2)).tolist()
+        self.masses = (0.5 + rng.random(5000)).tolist()
+
+    def get_serial_tree(self):
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions, self.masses)
+        return T
+
+    def test_same_tree_as_serial_insertion(self):
+
+        for n_threads in [1, 2, 4]:
+            C = QuadTree(Extent(0, 0, 1, 1))
+            C.insert_positions_concurrently(self.positions, self.masses, n_threads=n_threads)
+            assert_equal_trees(self.get_serial_tree(), C)
+
+    def test_single_point_insertion(self):
+
+        C = QuadTree(Extent(0, 0, 1, 1))
+        for i, (pos, mass) in enumerate(zip(self.positions, self.masses)):
+            assert(C.insert_concurrent(tuple(pos), mass, i))
+        C.update_aggregates()
+        assert_equal_trees(self.get_serial_tree(), C)
+
+    def test_forces(self):
+
+        C = QuadTree(Extent(0, 0, 1, 1))
+        C.insert_positions_concurrently(self.positions, self.masses, n_threads=4)
+
+        queries = np.array([(0.1, 0.2), (0.5, 0.5), (0.93, 0.41)])
+        expected = direct_forces(queries, np.array(self.positions), np.array(self.masses))
+        for q, force in zip(queries, expected):
+            # theta = 0 never approximates a node, i.e. sums over all points
+            assert(np.allclose(C.compute_force(tuple(q), theta=0.0), force, rtol=1e-10))
+
+
+if __name__ == "__main__":
+
+    T = ConcurrentInsertionTest()
+    T.setUp()
+    T.test_same_tree_as_serial_insertion()
+    T.test_single_point_insertion()
+    T.test_forces()
@@ -0,0 +1,53 @@
+import unittest
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+
+
+class ConcurrentQueriesTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(21)
+        self.positions = rng.random((5000, 2))
+        self.queries = rng.random((64, 2))
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist())
+
+    def query(self, q):
+        q = tuple(q)
+        return (self.T.compute_force(q, 0.5),
+                self.T.get_distances_to(q, 0.3),
+                self.T.compute_quantities(np.array([q]), theta=0.5, n_threads=1)['potential'][0])
+
+    def test_same_results_as_serial_queries(self):
+
+        expected = [ self.query(q) for q in self.queries ]
+        with ThreadPoolExecutor(max_workers=8) as executor:
+            results = list(executor.map(self.query, self.queries))
+        assert(results == expected)
+
+        with ThreadPoolExecutor(max_workers=4) as executor:
+            arrays = list(executor.map(lambda T: T.export_arrays(), [self.T] * 4))
+        for a in arrays[1:]:
+            for key in a:
+                assert(np.array_equal(a[key], arrays[0][key]))
+
+    def test_queries_from_a_subtree(self):
+
+        # a subtree can be queried with the settings of the whole tree
+        q = tuple(self.queries[0])
+        for subtree in self.T.get_subtrees():
+            assert(not subtree.is_leaf())
+            assert(self.T.get_distances_to(q, 0.3, True, subtree) == subtree.get_distances_to(q, 0.3))
+            total = sum(c for d, c in self.T.get_distances_to(q, 0.3, True, subtree))
+            assert(total == subtree.number_of_contained_points)
+
+
+if __name__ == "__main__":
+
+    T = ConcurrentQueriesTest()
+    T.setUp()
+    T.test_same_results_as_serial_queries()
+    T.test_queries_from_a_subtree()
@@ -0,0 +1,56 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_distances
+
+
+class CSRTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(11)
+        self.positions = rng.random((3000, 2))
+        # the first queries coincide with points of the tree
+        self.queries = np.concatenate([self.positions[:20], rng.random((80, 2))])
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist())
+
+    def test_same_as_single_queries(self):
+
+        for theta in [0.0, 0.2, 0.5]:
+            for ignore_zero_distance in [True, False]:
+                for n_threads in [1, 4]:
+                    offsets, distances, counts = self.T.get_distances_to_points_csr(
+                            self.queries.tolist(), theta, ignore_zero_distance, n_threads)
+                    assert(len(offsets) == len(self.queries) + 1)
+                    assert(offsets[0] == 0 and offsets[-1] == len(distances) == len(counts))
+
+                    for i, q in enumerate(self.queries):
+                        expected = self.T.get_distances_to(tuple(q), theta, ignore_zero_distance)
+                        row = slice(offsets[i], offsets[i+1])
+                        assert(distances[row].tolist() == [ d for d, c in expected ])
+                        assert(counts[row].tolist() == [ c for d, c in expected ])
+
+                        # every point is counted once, the query point itself only
+                        # if zero distances aren't ignored (for theta < 1/sqrt(2),
+                        # nodes containing the query are never approximated)
+                        coincides = i < 20
+                        expected_count = len(self.positions) - (coincides and ignore_zero_distance)
+                        assert(counts[row].sum() == expected_count)
+
+    def test_brute_force(self):
+
+        offsets, distances, counts = self.T.get_distances_to_points_csr(self.queries.tolist(), theta=0.0)
+        assert(np.all(counts == 1))
+        for i, q in enumerate(self.queries):
+            row = slice(offsets[i], offsets[i+1])
+            assert(np.allclose(np.sort(distances[row]), direct_distances(q, self.positions)))
+
+
+if __name__ == "__main__":
+
+    T = CSRTest()
+    T.setUp()
+    T.test_same_as_single_queries()
+    T.test_brute_force()
@@ -0,0 +1,81 @@
+import unittest
+
+import numpy as np
+
+from _cQuadTree import weighted_histogram
+from cQuadTree import QuadTree, Extent, estimate_distance_histogram
+
+
+class DistanceSamplingTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(19)
+        # a dense cluster and a uniform background
+        self.positions = np.concatenate([0.6 + 0.02 * rng.standard_normal((800, 2)),
+                                         rng.random((1200, 2))])
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist())
+        self.bin_edges = np.array([0, 0.02, 0.05, 0.1, 0.2, 0.3, 0.45, 0.6, 0.8, 1.0, 1.5])
+        self.theta = 0.3
+
+        # the histogram over all query points
+        offsets, distances, counts = self.T.get_distances_to_points_csr(self.positions.tolist(), self.theta)
+        self.exact = weighted_histogram(distances, counts.astype(np.int64), self.bin_edges)
+
+    def test_unbiased(self):
+
+        N = len(self.positions)
+        estimates = []
+        variances = []
+        for seed in range(20):
+            hist, variance = self.T.estimate_distance_histogram(self.bin_edges, sample_budget=200,
+                                                                theta=self.theta, seed=seed)
+            # every query point has N-1 partners, all within the bins
+            assert(np.isclose(hist.sum(), N * (N-1), rtol=1e-12))
+            assert(np.all(variance >= 0))
+            estimates.append(hist)
+            variances.append(variance)
+
+        # the mean over independent estimates is within a few standard errors
+        mean = np.mean(estimates, axis=0)
+        standard_error = np.sqrt(np.mean(variances, axis=0) / len(estimates))
+        assert(np.all(np.abs(mean - self.exact) <= 5 * standard_error + 1e-2 * self.exact))
+
+        # the result doesn't depend on the number of threads
+        a = self.T.estimate_distance_histogram(self.bin_edges, 200, self.theta, seed=3, n_threads=1)
+        b = self.T.estimate_distance_histogram(self.bin_edges, 200, self.theta, seed=3, n_threads=4)
+        assert(np.allclose(a[0], b[0], rtol=1e-12) and np.allclose(a[1], b[1], rtol=1e-12))
+
+    def test_census(self):
+
+        # a budget of at least N evaluates every point exactly once
+        N = len(self.positions)
+        for sample_budget in [N, 2 * N]:
+            hist, variance = self.T.estimate_distance_histogram(self.bin_edges, sample_budget=sample_budget,
+                                                                theta=self.theta, seed=5)
+            assert(np.allclose(hist, self.exact, rtol=1e-12))
+            assert(np.all(variance == 0))
+
+        # close to a census, the finite population correction shrinks the variance
+        _, variance = self.T.estimate_distance_histogram(self.bin_edges, sample_budget=N - 100,
+                                                         theta=self.theta, seed=5)
+        _, small_sample_variance = self.T.estimate_distance_histogram(self.bin_edges, sample_budget=200,
+                                                                      theta=self.theta, seed=5)
+        assert(np.all(variance <= small_sample_variance))
+
+    def test_density(self):
+
+        hist, std, bin_edges = estimate_distance_histogram(self.T, self.bin_edges[::-1], sample_budget=200,
+                                                           theta=self.theta)
+        assert(np.array_equal(bin_edges, self.bin_edges))
+        assert(np.isclose((hist * np.diff(bin_edges)).sum(), 1))
+        assert(np.all(std >= 0))
+
+
+if __name__ == "__main__":
+
+    T = DistanceSamplingTest()
+    T.setUp()
+    T.test_unbiased()
+    T.test_census()
+    T.test_density()
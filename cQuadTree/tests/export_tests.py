@@ -0,0 +1,63 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent, get_points_and_boxes
+
+
+class ExportTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(13)
+        # a dense cluster and a uniform background
+        self.positions = np.concatenate([0.2 + 0.01 * rng.random((500, 2)), rng.random((1500, 2))])
+        self.masses = 0.5 + rng.random(len(self.positions))
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist(), self.masses.tolist(), 7)
+
+    def test_same_as_recursive_walk(self):
+
+        points, boxes = get_points_and_boxes(self.T)
+        leaf_positions, box_array = get_points_and_boxes(self.T, as_arrays=True)
+        assert(np.array_equal(leaf_positions, [ (p.x, p.y) for p in points ]))
+        assert(np.array_equal(box_array, [ (b.left(), b.bottom(), b.width(), b.height()) for b in boxes ]))
+
+    def test_arrays(self):
+
+        a = self.T.export_arrays()
+        n_nodes = len(a['left'])
+        for key in ['bottom', 'width', 'height', 'depth', 'parent', 'mass', 'number_of_contained_points']:
+            assert(a[key].shape == (n_nodes,))
+        assert(a['center_of_mass'].shape == (n_nodes, 2))
+
+        # every point is in exactly one leaf, with its id
+        ids = a['leaf_ids'] - 7
+        assert(np.array_equal(np.sort(ids), np.arange(len(self.positions))))
+        assert(np.array_equal(a['leaf_positions'], self.positions[ids]))
+        assert(np.array_equal(a['mass'][a['leaf_nodes']], self.masses[ids]))
+
+        # pre-order: parents come first and are one level up
+        parent = a['parent']
+        assert(parent[0] == -1 and np.all(parent[1:] >= 0) and np.all(parent[1:] < np.arange(1, n_nodes)))
+        assert(np.array_equal(a['depth'][1:], a['depth'][parent[1:]] + 1))
+
+        # the aggregates of every node sum up those of its children
+        mass = np.zeros(n_nodes)
+        number_of_points = np.zeros(n_nodes, dtype=a['number_of_contained_points'].dtype)
+        np.add.at(mass, parent[1:], a['mass'][1:])
+        np.add.at(number_of_points, parent[1:], a['number_of_contained_points'][1:])
+        internal = np.setdiff1d(np.arange(n_nodes), a['leaf_nodes'])
+        assert(np.allclose(mass[internal], a['mass'][internal], rtol=1e-12))
+        assert(np.array_equal(number_of_points[internal], a['number_of_contained_points'][internal]))
+        assert(a['number_of_contained_points'][0] == len(self.positions))
+
+        center_of_mass = (self.masses[:, None] * self.positions).sum(axis=0) / self.masses.sum()
+        assert(np.allclose(a['center_of_mass'][0], center_of_mass, rtol=1e-12))
+
+
+if __name__ == "__main__":
+
+    T = ExportTest()
+    T.setUp()
+    T.test_same_as_recursive_walk()
+    T.test_arrays()
@@ -0,0 +1,82 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_log_forces_and_potentials
+
+
+def get_errors(forces, potentials, expected_forces, expected_potentials):
+    force_error = np.linalg.norm(forces - expected_forces, axis=1).max()
+    potential_error = np.abs(potentials - expected_potentials).max()
+    return force_error / np.linalg.norm(expected_forces, axis=1).max(), \
+           potential_error / np.abs(expected_potentials).max()
+
+
+class FMMTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(4)
+        # a dense cluster and a uniform background
+        self.positions = np.concatenate([(0.3, 0.7) + 0.05 * rng.standard_normal((1000, 2)),
+                                         rng.random((2000, 2))])
+        self.masses = 0.5 + rng.random(len(self.positions))
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist(), self.masses.tolist())
+        self.expected = direct_log_forces_and_potentials(self.positions, self.masses)
+
+    def test_direct_summation(self):
+
+        for n_threads in [1, 4]:
+            forces, potentials = self.T.compute_fmm(order=10, theta=0.5, n_threads=n_threads)
+            assert(forces.shape == (len(self.positions), 2))
+            force_error, potential_error = get_errors(forces, potentials, *self.expected)
+            assert(force_error < 1e-4)
+            assert(potential_error < 1e-5)
+
+    def test_error_decreases_with_order(self):
+
+        errors = [ get_errors(*self.T.compute_fmm(order=order, theta=0.5), *self.expected)
+                   for order in [4, 8, 12] ]
+        assert(errors[0][0] > errors[1][0] > errors[2][0])
+        assert(errors[0][1] > errors[1][1] > errors[2][1])
+
+    def test_rows_are_indexed_by_id(self):
+
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions.tolist(), self.masses.tolist(), first_id=10)
+        forces, potentials = T.compute_fmm()
+        assert(forces.shape == (len(self.positions) + 10, 2))
+        assert(np.all(forces[:10] == 0) and np.all(potentials[:10] == 0))
+        force_error, potential_error = get_errors(forces[10:], potentials[10:], *self.expected)
+        assert(force_error < 1e-4)
+
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions.tolist(), first_id=100_000_000)
+        with self.assertRaises(ValueError):
+            T.compute_fmm()
+
+        # two batches whose ids overlap would share rows
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions[:100].tolist())
+        T.insert_positions(self.positions[100:200].tolist(), first_id=50)
+        with self.assertRaises(ValueError):
+            T.compute_fmm()
+
+    def test_periodic_trees_are_rejected(self):
+
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.set_periodic()
+        T.insert_positions(self.positions.tolist())
+        with self.assertRaises(RuntimeError):
+            T.compute_fmm()
+
+
+if __name__ == "__main__":
+
+    T = FMMTest()
+    T.setUp()
+    T.test_direct_summation()
+    T.test_error_decreases_with_order()
+    T.test_rows_are_indexed_by_id()
+    T.test_periodic_trees_are_rejected()
@@ -0,0 +1,45 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+
+
+class HilbertOrderTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(20)
+        self.positions = rng.random((3000, 2))
+        self.masses = 0.5 + rng.random(3000)
+        # queries inside and outside of the root box
+        self.queries = np.concatenate([rng.random((400, 2)), 3 * rng.random((100, 2)) - 1])
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist(), self.masses.tolist())
+
+    def test_quantities(self):
+
+        kwargs = dict(theta=0.5, radius=0.05, mass_within_radius=True, number_of_interactions=True)
+        for n_threads in [1, 4]:
+            a = self.T.compute_quantities(self.queries, hilbert_order=True, n_threads=n_threads, **kwargs)
+            b = self.T.compute_quantities(self.queries, hilbert_order=False, n_threads=n_threads, **kwargs)
+            assert(a.keys() == b.keys())
+            # every query is evaluated on its own, so the order doesn't change the results
+            for key in a:
+                assert(np.array_equal(a[key], b[key]))
+
+    def test_csr(self):
+
+        queries = self.queries.tolist()
+        for n_threads in [1, 4]:
+            a = self.T.get_distances_to_points_csr(queries, 0.3, True, n_threads, True)
+            b = self.T.get_distances_to_points_csr(queries, 0.3, True, n_threads, False)
+            for x, y in zip(a, b):
+                assert(np.array_equal(x, y))
+
+
+if __name__ == "__main__":
+
+    T = HilbertOrderTest()
+    T.setUp()
+    T.test_quantities()
+    T.test_csr()
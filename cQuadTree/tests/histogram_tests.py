@@ -0,0 +1,64 @@
+import unittest
+
+import numpy as np
+
+from _cQuadTree import weighted_histogram
+from cQuadTree import histogram
+
+
+def searchsorted_histogram(data, counts, bin_edges):
+    # the Python loop `histogram` used before the native kernel
+    new_counts = np.zeros(len(bin_edges)-1, dtype=int)
+    ndcs = np.searchsorted(bin_edges, data)
+    allowed_ndcs = np.where(np.logical_and(ndcs>0, ndcs<=len(new_counts)))
+    for ndx, C in zip(ndcs[allowed_ndcs], counts[allowed_ndcs]):
+        new_counts[ndx-1] += C
+    return new_counts
+
+
+class HistogramTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(12)
+        self.bin_edges = {
+                'linear': np.linspace(0.1, 1.5, 29),
+                'logarithmic': np.logspace(-2, 0.2, 23),
+                'arbitrary': np.sort(0.05 + 1.4 * rng.random(17)),
+            }
+        data = 1.6 * rng.random(20000)
+        counts = rng.integers(1, 100, size=len(data))
+
+        # values on every edge, outside of the bins, and NaN
+        edges = np.concatenate(list(self.bin_edges.values()))
+        self.data = np.concatenate([data, edges, [-1.0, 0.0, 10.0, np.nan, np.nan]])
+        self.counts = np.concatenate([counts, rng.integers(1, 100, size=len(edges) + 5)])
+
+    def test_same_as_searchsorted(self):
+
+        for spacing, bin_edges in self.bin_edges.items():
+            expected = searchsorted_histogram(self.data, self.counts, bin_edges)
+            for n_threads in [1, 4]:
+                result = weighted_histogram(self.data, self.counts, bin_edges, n_threads)
+                assert(np.array_equal(result, expected))
+
+            hist, _ = histogram(self.data, self.counts, bin_edges[::-1], density=False)
+            assert(np.array_equal(hist, expected))
+
+    def test_edges(self):
+
+        bin_edges = np.array([0.0, 0.5, 1.0])
+        data = np.array([0.0, 0.5, 1.0, np.nan, np.nextafter(1.0, 2), np.nextafter(0.5, 1)])
+        counts = np.array([1, 10, 100, 1000, 10000, 100000])
+        # left edges are excluded, right edges included
+        assert(weighted_histogram(data, counts, bin_edges).tolist() == [10, 100100])
+
+        with self.assertRaises(ValueError):
+            weighted_histogram(data, counts[:-1], bin_edges)
+
+
+if __name__ == "__main__":
+
+    T = HistogramTest()
+    T.setUp()
+    T.test_same_as_searchsorted()
+    T.test_edges()
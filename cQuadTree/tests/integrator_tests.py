@@ -0,0 +1,96 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import Integrator
+from cQuadTree.tests.brute_force import direct_forces
+
+
+def velocity_verlet(positions, velocities, masses, dt, coupling, n_steps):
+    x = positions.copy()
+    v = velocities.copy()
+    a = coupling * direct_forces(x, x, masses)
+    for step in range(n_steps):
+        v += 0.5 * dt * a
+        x += dt * v
+        a = coupling * direct_forces(x, x, masses)
+        v += 0.5 * dt * a
+    return x, v
+
+
+class IntegratorTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(15)
+        self.positions = rng.random((300, 2))
+        self.velocities = 0.1 * rng.standard_normal((300, 2))
+        self.masses = (0.5 + rng.random(300)) / 300
+
+    def get_integrator(self):
+        I = Integrator()
+        I.dt = 1e-3
+        # theta = 0 never approximates a node, i.e. sums over all points
+        I.theta = 0.0
+        I.coupling = -0.01
+        return I
+
+    def test_same_trajectory_as_velocity_verlet(self):
+
+        expected = velocity_verlet(self.positions, self.velocities, self.masses, 1e-3, -0.01, 5)
+
+        for n_threads in [1, 4]:
+            I = self.get_integrator()
+            I.n_threads = n_threads
+            positions = self.positions.copy()
+            velocities = self.velocities.copy()
+            assert(I.integrate(positions, velocities, self.masses.tolist(), n_steps=5) == 5)
+            assert(np.allclose(positions, expected[0], rtol=1e-10, atol=1e-10))
+            assert(np.allclose(velocities, expected[1], rtol=1e-8, atol=1e-10))
+
+    def test_callback_and_max_displacement(self):
+
+        I = self.get_integrator()
+        I.max_displacement = 1e-5
+        positions = self.positions.copy()
+        velocities = self.velocities.copy()
+
+        steps = []
+        def callback(step):
+            steps.append(step)
+            return step < 6
+
+        assert(I.integrate(positions, velocities, self.masses.tolist(), n_steps=10,
+                           callback=callback, callback_every=2) == 6)
+        assert(steps == [2, 4, 6])
+        displacement = np.linalg.norm(positions - self.positions, axis=1)
+        assert(np.all(displacement <= 6 * 1e-5 * (1 + 1e-12)))
+
+    def test_arrays_are_updated_in_place(self):
+
+        I = self.get_integrator()
+        masses = self.masses.tolist()
+
+        # arrays that would have to be converted are rejected
+        for positions in [self.positions.astype(np.float32), np.asfortranarray(self.positions)]:
+            with self.assertRaises(TypeError):
+                I.integrate(positions, self.velocities.copy(), masses)
+
+        positions = self.positions.copy()
+        positions.flags.writeable = False
+        with self.assertRaises(ValueError):
+            I.integrate(positions, self.velocities.copy(), masses)
+
+        # cooling doesn't change the maximum displacement of later calls
+        I.max_displacement = 1e-3
+        I.cooling = 0.5
+        I.integrate(self.positions.copy(), self.velocities.copy(), masses, n_steps=4)
+        assert(I.max_displacement == 1e-3)
+
+
+if __name__ == "__main__":
+
+    T = IntegratorTest()
+    T.setUp()
+    T.test_same_trajectory_as_velocity_verlet()
+    T.test_callback_and_max_displacement()
+    T.test_arrays_are_updated_in_place()
@@ -0,0 +1,105 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent, InteractionListCache
+
+
+class InteractionListCacheTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(16)
+        self.rng = rng
+        self.positions = rng.random((3000, 2))
+        self.queries = rng.random((200, 2))
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist())
+
+    def get_forces(self, T, queries, theta):
+        return np.array([ T.compute_force(tuple(q), theta) for q in queries ])
+
+    def test_same_as_compute_force(self):
+
+        for n_threads in [1, 4]:
+            cache = InteractionListCache(theta=0.5, n_threads=n_threads)
+            forces = cache.compute_forces(self.T, self.queries)
+            assert(cache.number_of_rebuilt_lists == len(self.queries))
+            assert(forces.shape == (len(self.queries), 2))
+            assert(np.allclose(forces, self.get_forces(self.T, self.queries, 0.5), rtol=1e-12))
+
+            # the same queries reuse all lists
+            assert(np.array_equal(cache.compute_forces(self.T, self.queries), forces))
+            assert(cache.number_of_rebuilt_lists == 0)
+
+            cache.invalidate()
+            assert(np.array_equal(cache.compute_forces(self.T, self.queries), forces))
+            assert(cache.number_of_rebuilt_lists == len(self.queries))
+
+    def test_moving_queries(self):
+
+        cache = InteractionListCache(theta=0.5, tolerance=1e-3)
+        cache.compute_forces(self.T, self.queries)
+
+        # lists are reused within the tolerance
+        queries = self.queries + 1e-4
+        forces = cache.compute_forces(self.T, queries)
+        assert(cache.number_of_rebuilt_lists == 0)
+        expected = self.get_forces(self.T, queries, 0.5)
+        error = np.linalg.norm(forces - expected, axis=1)
+        assert(np.all(error <= 1e-2 * np.linalg.norm(expected, axis=1)))
+
+        # and rebuilt beyond it
+        queries[:50] += 1e-2
+        forces = cache.compute_forces(self.T, queries)
+        assert(cache.number_of_rebuilt_lists == 50)
+        assert(np.allclose(forces[:50], self.get_forces(self.T, queries[:50], 0.5), rtol=1e-12))
+
+    def test_theta_changes(self):
+
+        cache = InteractionListCache(theta=0.5)
+        cache.compute_forces(self.T, self.queries)
+
+        # lists built with another theta are never reused
+        cache.theta = 0.3
+        forces = cache.compute_forces(self.T, self.queries)
+        assert(cache.number_of_rebuilt_lists == len(self.queries))
+        assert(np.allclose(forces, self.get_forces(self.T, self.queries, 0.3), rtol=1e-12))
+
+        cache.compute_forces(self.T, self.queries)
+        assert(cache.number_of_rebuilt_lists == 0)
+
+    def test_topology_changes(self):
+
+        cache = InteractionListCache(theta=0.5)
+        cache.compute_forces(self.T, self.queries)
+
+        self.T.insert((0.123, 0.456), 1.0, len(self.positions))
+        forces = cache.compute_forces(self.T, self.queries)
+        assert(cache.number_of_rebuilt_lists == len(self.queries))
+        assert(np.allclose(forces, self.get_forces(self.T, self.queries, 0.5), rtol=1e-12))
+
+    def test_refit(self):
+
+        cache = InteractionListCache(theta=0.5)
+        positions = self.positions.copy()
+        for _ in range(3):
+            cache.compute_forces(self.T, self.queries)
+            positions += 0.01 * self.rng.standard_normal(positions.shape)
+            self.T.refit(positions)
+            # refit moves points without changing the topology,
+            # the lists are rebuilt nevertheless
+            forces = cache.compute_forces(self.T, self.queries)
+            assert(cache.number_of_rebuilt_lists == len(self.queries))
+            assert(np.allclose(forces, self.get_forces(self.T, self.queries, 0.5), rtol=1e-12))
+
+
+if __name__ == "__main__":
+
+    T = InteractionListCacheTest()
+    T.setUp()
+    T.test_same_as_compute_force()
+    T.test_moving_queries()
+    T.test_theta_changes()
+    T.test_topology_changes()
+    T.setUp()
+    T.test_refit()
@@ -0,0 +1,61 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_density
+
+
+class KernelDensityTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(3)
+        # a dense cluster and a uniform background
+        self.positions = np.concatenate([0.5 + 0.05 * rng.standard_normal((2000, 2)),
+                                         rng.random((2000, 2))])
+        self.masses = 0.5 + rng.random(len(self.positions))
+        self.queries = rng.random((200, 2))
+        self.T = QuadTree(self.positions.tolist(), self.masses.tolist())
+
+    def test_error_bounds(self):
+
+        for kernel in ['gaussian', 'epanechnikov']:
+            for bandwidth in [0.02, 0.1]:
+                expected = direct_density(self.queries, self.positions, self.masses, bandwidth, kernel)
+                for atol, rtol in [(0.0, 1e-2), (0.0, 1e-4), (1e-3, 0.0)]:
+                    density = self.T.kernel_density(self.queries, bandwidth, kernel=kernel,
+                                                    atol=atol, rtol=rtol, n_threads=2)
+                    assert(np.all(np.abs(density - expected) <= atol + rtol * expected + 1e-12))
+
+    def test_grid(self):
+
+        geom = Extent(0, 0, 1, 1)
+        nx, ny = 40, 30
+        density = self.T.kernel_density_on_grid(geom, nx, ny, bandwidth=0.05, rtol=1e-3)
+        assert(density.shape == (ny, nx))
+
+        x = (np.arange(nx) + 0.5) / nx
+        y = (np.arange(ny) + 0.5) / ny
+        X, Y = np.meshgrid(x, y)
+        grid = np.column_stack([X.ravel(), Y.ravel()])
+        expected = direct_density(grid, self.positions, self.masses, 0.05, 'gaussian').reshape(ny, nx)
+        assert(np.all(np.abs(density - expected) <= 1e-3 * expected + 1e-12))
+
+    def test_periodic_trees_are_rejected(self):
+
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.set_periodic()
+        T.insert_positions(self.queries.tolist())
+        with self.assertRaises(RuntimeError):
+            T.kernel_density(self.queries, 0.1)
+        with self.assertRaises(RuntimeError):
+            T.kernel_density_on_grid(Extent(0, 0, 1, 1), 10, 10, 0.1)
+
+
+if __name__ == "__main__":
+
+    T = KernelDensityTest()
+    T.setUp()
+    T.test_error_bounds()
+    T.test_grid()
+    T.test_periodic_trees_are_rejected()
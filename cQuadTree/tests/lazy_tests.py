@@ -0,0 +1,71 @@
+import unittest
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import assert_equal_trees
+
+
+class LazyTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(6)
+        self.positions = rng.random((5000, 2))
+        self.masses = (0.5 + rng.random(5000)).tolist()
+        self.queries = rng.random((100, 2))
+
+    def get_trees(self):
+        eager = QuadTree(Extent(0, 0, 1, 1))
+        eager.insert_positions(self.positions.tolist(), self.masses)
+        lazy = QuadTree(Extent(0, 0, 1, 1))
+        lazy.insert_positions_lazily(self.positions, self.masses)
+        return eager, lazy
+
+    def test_same_results_as_eager_tree(self):
+
+        eager, lazy = self.get_trees()
+        assert(lazy.is_lazy())
+        assert(lazy.number_of_contained_points == eager.number_of_contained_points)
+        assert(np.isclose(lazy.total_mass, eager.total_mass))
+
+        for q in self.queries[:20]:
+            q = tuple(q)
+            assert(np.allclose(lazy.compute_force(q, 0.5), eager.compute_force(q, 0.5), rtol=1e-12))
+            a = np.array(lazy.get_distances_to(q, 0.2))
+            b = np.array(eager.get_distances_to(q, 0.2))
+            assert(a.shape == b.shape)
+            assert(np.allclose(a, b, rtol=1e-12))
+
+        kwargs = dict(theta=0.5, radius=0.1, mass_within_radius=True, number_of_interactions=True)
+        a = lazy.compute_quantities(self.queries, **kwargs)
+        b = eager.compute_quantities(self.queries, **kwargs)
+        for key in b:
+            assert(np.allclose(a[key], b[key], rtol=1e-12))
+
+        for radius in [0.01, 0.05]:
+            assert(lazy.count_neighbor_pairs(radius) == eager.count_neighbor_pairs(radius))
+
+        # the fully refined tree has the same nodes and leaves
+        assert_equal_trees(lazy, eager)
+
+    def test_concurrent_queries(self):
+
+        eager, lazy = self.get_trees()
+
+        def query(q):
+            return lazy.compute_force(tuple(q), 0.3)
+
+        with ThreadPoolExecutor(max_workers=4) as executor:
+            forces = list(executor.map(query, self.queries))
+
+        for q, force in zip(self.queries, forces):
+            assert(np.allclose(force, eager.compute_force(tuple(q), 0.3), rtol=1e-12))
+
+
+if __name__ == "__main__":
+
+    T = LazyTest()
+    T.setUp()
+    T.test_same_results_as_eager_tree()
+    T.test_concurrent_queries()
@@ -0,0 +1,129 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import assert_equal_trees
+
+
+class MergeTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(7)
+        self.positions = rng.random((8000, 2))
+        self.masses = 0.5 + rng.random(8000)
+        self.queries = rng.random((100, 2))
+
+    def get_single_tree(self, positions, masses):
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(positions.tolist(), masses.tolist())
+        return T
+
+    def merge_shards(self, extents, positions, masses):
+        shards = np.array_split(np.arange(len(positions)), len(extents))
+        T = QuadTree(Extent(0, 0, 1, 1))
+        for extent, ids in zip(extents, shards):
+            shard = QuadTree(extent)
+            shard.insert_positions(positions[ids].tolist(), masses[ids].tolist(), first_id=int(ids[0]))
+            T.merge(shard)
+            assert(shard.number_of_contained_points == 0)
+        return T
+
+    def assert_same_aggregates(self, A, B):
+        assert(A.number_of_contained_points == B.number_of_contained_points)
+        assert(np.isclose(A.total_mass, B.total_mass, rtol=1e-12))
+        assert_equal_trees(A, B)
+        for kwargs in [dict(theta=0.0), dict(theta=0.5)]:
+            qa = A.compute_quantities(self.queries, **kwargs)
+            qb = B.compute_quantities(self.queries, **kwargs)
+            assert(np.allclose(qa['force'], qb['force'], rtol=1e-10))
+            assert(np.allclose(qa['potential'], qb['potential'], rtol=1e-10))
+
+    def test_shards_with_equal_extents(self):
+
+        T = self.merge_shards([Extent(0, 0, 1, 1)] * 4, self.positions, self.masses)
+        self.assert_same_aggregates(T, self.get_single_tree(self.positions, self.masses))
+
+    def test_quadrant_shards(self):
+
+        # sort the points by quadrant, such that shard k holds quadrant k
+        quadrants = [Extent(0, 0.5, 0.5, 0.5), Extent(0.5, 0.5, 0.5, 0.5),
+                     Extent(0.5, 0, 0.5, 0.5), Extent(0, 0, 0.5, 0.5)]
+        x, y = self.positions.T
+        quadrant = np.where(y >= 0.5, np.where(x >= 0.5, 1, 0), np.where(x >= 0.5, 2, 3))
+        order = np.argsort(quadrant, kind='stable')
+        positions = self.positions[order]
+        masses = self.masses[order]
+
+        shards = [ np.where(quadrant[order] == k)[0] for k in range(4) ]
+        T = QuadTree(Extent(0, 0, 1, 1))
+        for extent, ids in zip(quadrants, shards):
+            shard = QuadTree(extent)
+            shard.insert_positions(positions[ids].tolist(), masses[ids].tolist(), first_id=int(ids[0]))
+            T.merge(shard)
+        self.assert_same_aggregates(T, self.get_single_tree(positions, masses))
+
+    def test_nearly_aligned_extents(self):
+
+        # the shard's extent matches the south-east quadrant of the root only up to
+        # rounding, its right edge lies one unit in the last place further out
+        rng = np.random.default_rng(8)
+        T = QuadTree(Extent(0.1, 0.2, 0.3, 0.3))
+        dense = np.column_stack([0.25 + 1e-3 * rng.random(1000), 0.2 + 0.15 * rng.random(1000)])
+        T.insert_positions(np.concatenate([(0.1, 0.2) + 0.3 * self.positions[:1000], dense]).tolist())
+
+        right = np.nextafter(0.4, 1)
+        def get_shard(positions):
+            shard = QuadTree(Extent(0.25, 0.2, right - 0.25, 0.15))
+            shard.insert_positions(positions.tolist(), first_id=2000)
+            return shard
+
+        # a point on the shard's right edge would have to move into the cell
+        shard = get_shard(np.array([(0.3, 0.3), (right, 0.3)]))
+        with self.assertRaises(ValueError):
+            T.merge(shard)
+        assert(T.number_of_contained_points == 2000 and shard.number_of_contained_points == 2)
+
+        # a shard that is off by more than rounding errors isn't aligned
+        shifted = QuadTree(Extent(0.25 - 1e-12, 0.2, 0.15, 0.15))
+        shifted.insert_positions([(0.3, 0.3)])
+        with self.assertRaises(ValueError):
+            T.merge(shifted)
+
+        # points on the boundary the shard shares with the root's other cells stay in the tree
+        edge = np.column_stack([np.full(50, 0.25), 0.2 + 0.15 * rng.random(50)])
+        inner = np.column_stack([0.25 + 0.15 * rng.random(1950), 0.2 + 0.15 * rng.random(1950)])
+        T.merge(get_shard(np.concatenate([edge, inner])))
+
+        arrays = T.export_arrays()
+        assert(T.number_of_contained_points == 4000)
+        assert(len(arrays['leaf_ids']) == 4000)
+        assert(np.isclose(T.total_mass, 4000))
+        assert(np.array_equal(np.sort(arrays['leaf_ids']), np.arange(4000)))
+
+    def test_invalid_merges(self):
+
+        A = QuadTree(Extent(0, 0, 1, 1))
+        A.set_periodic()
+        B = QuadTree(Extent(0, 0, 0.5, 0.5))
+        B.set_periodic()
+        with self.assertRaises(ValueError):
+            A.merge(B)
+
+        A = QuadTree(Extent(0, 0, 1, 1))
+        A.insert_positions([(0.7, 0.7)])
+        B = QuadTree(Extent(0, 0, 1, 1))
+        B.insert_positions([(0.1, 0.1), (0.2, 0.2)])
+        B.refit(np.array([(2.0, 2.0), (0.2, 0.2)]))
+        with self.assertRaises(RuntimeError):
+            A.merge(B)
+
+
+if __name__ == "__main__":
+
+    T = MergeTest()
+    T.setUp()
+    T.test_shards_with_equal_extents()
+    T.test_quadrant_shards()
+    T.test_nearly_aligned_extents()
+    T.test_invalid_merges()
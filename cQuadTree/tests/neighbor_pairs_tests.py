@@ -0,0 +1,55 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import brute_force_pairs
+
+
+class NeighborPairsTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(9)
+        self.rng = rng
+        self.positions = rng.random((2000, 2))
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist())
+
+    def assert_brute_force(self, T, positions):
+        for radius in [0.0, 0.01, 0.03, 0.1]:
+            expected, r = brute_force_pairs(positions, radius)
+            for n_threads in [1, 4]:
+                pairs, distances = T.get_neighbor_pairs(radius, n_threads)
+                assert(pairs.shape == (len(expected), 2))
+                assert(set(map(tuple, pairs.tolist())) == expected)
+                assert(np.allclose(distances, r[pairs[:, 0], pairs[:, 1]]))
+                assert(T.count_neighbor_pairs(radius, n_threads) == len(expected))
+
+    def test_brute_force(self):
+
+        self.assert_brute_force(self.T, self.positions)
+
+    def test_after_refit(self):
+
+        # a point moved out of its node into the box of another one
+        T = QuadTree(Extent(0, 0, 1, 1))
+        positions = np.array([(0.1, 0.1), (0.12, 0.1), (0.9, 0.9), (0.5, 0.5)])
+        T.insert_positions(positions.tolist())
+        positions[2] = (0.11, 0.11)
+        T.refit(positions)
+        assert(T.count_neighbor_pairs(0.05, 1) == 3)
+
+        positions = self.positions.copy()
+        for _ in range(3):
+            positions += 0.01 * self.rng.standard_normal(positions.shape)
+            self.T.refit(positions)
+            self.assert_brute_force(self.T, positions)
+        assert(self.T.box_slack > 0)
+
+
+if __name__ == "__main__":
+
+    T = NeighborPairsTest()
+    T.setUp()
+    T.test_brute_force()
+    T.test_after_refit()
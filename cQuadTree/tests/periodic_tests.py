@@ -0,0 +1,68 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, direct_distances, brute_force_pairs
+
+
+class PeriodicTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(5)
+        self.L = 2.0
+        self.positions = self.L * rng.random((2000, 2))
+        self.queries = self.L * rng.random((50, 2))
+        self.T = QuadTree(Extent(0, 0, self.L, self.L))
+        self.T.set_periodic()
+        self.T.insert_positions(self.positions.tolist())
+
+    def test_forces_and_distances(self):
+
+        masses = np.ones(len(self.positions))
+        expected_forces = direct_forces(self.queries, self.positions, masses, period=self.L)
+        for q, expected in zip(self.queries, expected_forces):
+            # theta = 0 never approximates a node, i.e. sums over all points
+            assert(np.allclose(self.T.compute_force(tuple(q), theta=0.0), expected, rtol=1e-10))
+
+            distances = self.T.get_distances_to(tuple(q), theta=0.0)
+            assert(np.allclose(np.sort([d for d, c in distances]), direct_distances(q, self.positions, period=self.L)))
+
+            # with approximations, every point is still counted exactly once
+            distances = self.T.get_distances_to(tuple(q), theta=0.5)
+            assert(sum(c for d, c in distances) == len(self.positions))
+
+    def test_neighbor_pairs(self):
+
+        for radius in [0.02, 0.1, 0.5]:
+            expected, r = brute_force_pairs(self.positions, radius, period=self.L)
+            pairs, distances = self.T.get_neighbor_pairs(radius)
+            assert(set(map(tuple, pairs.tolist())) == expected)
+            assert(np.allclose(distances, r[pairs[:, 0], pairs[:, 1]]))
+            assert(self.T.count_neighbor_pairs(radius) == len(expected))
+
+    def test_wrapped_insertion(self):
+
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.set_periodic()
+        for pos in [(-0.25, 0.5), (1.6, -3.7), (1e300, 0.3), (-1e-20, -1e-20)]:
+            T.insert(pos)
+            image = T.wrap_position(pos)
+            assert(0 <= image[0] <= 1 and 0 <= image[1] <= 1)
+        assert(T.number_of_contained_points == 4)
+        assert(np.allclose(T.wrap_position((-0.25, 0.5)), (0.75, 0.5)))
+        assert(np.allclose(T.wrap_position((1.6, -3.7)), (0.6, 0.3)))
+
+        # non-finite points are dropped instead of being wrapped forever
+        for pos in [(np.nan, 0.5), (np.inf, 0.5), (0.5, -np.inf)]:
+            T.insert(pos)
+        assert(T.number_of_contained_points == 4)
+
+
+if __name__ == "__main__":
+
+    T = PeriodicTest()
+    T.setUp()
+    T.test_forces_and_distances()
+    T.test_neighbor_pairs()
+    T.test_wrapped_insertion()
@@ -0,0 +1,90 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import VersionedQuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, direct_distances
+
+
+class PersistentTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(2)
+        self.positions = rng.random((3000, 2))
+        self.new_positions = rng.random((1000, 2))
+        self.queries = rng.random((50, 2))
+
+    def test_snapshot_matches_direct_sum(self):
+
+        T = VersionedQuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions)
+        S = T.snapshot()
+
+        # theta = 0 never approximates a node, i.e. sums over all points
+        forces = S.compute_forces(self.queries, theta=0.0)
+        expected = direct_forces(self.queries, self.positions, np.ones(len(self.positions)))
+        assert(np.allclose(forces, expected, rtol=1e-10))
+
+        distances = S.get_distances_to(tuple(self.queries[0]), theta=0.0)
+        assert(np.allclose(np.sort([d for d, c in distances]), direct_distances(self.queries[0], self.positions)))
+
+    def test_snapshots_dont_change(self):
+
+        T = VersionedQuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions)
+        S = T.snapshot()
+
+        version = S.version
+        forces = S.compute_forces(self.queries, theta=0.5)
+        force = S.compute_force(tuple(self.queries[0]), theta=0.5)
+        distances = S.get_distances_to(tuple(self.queries[0]), theta=0.2)
+
+        T.insert_positions(self.new_positions, first_id=len(self.positions))
+        for pos in [(-0.5, 0.5), (1.5, 2.5)]:
+            T.insert(pos)
+
+        assert(S.version == version)
+        assert(S.number_of_contained_points() == len(self.positions))
+        assert(S.total_mass() == len(self.positions))
+        assert(np.array_equal(S.compute_forces(self.queries, theta=0.5), forces))
+        assert(S.compute_force(tuple(self.queries[0]), theta=0.5) == force)
+        assert(S.get_distances_to(tuple(self.queries[0]), theta=0.2) == distances)
+
+        N = len(self.positions) + len(self.new_positions) + 2
+        S_new = T.snapshot()
+        assert(S_new.version > version)
+        assert(S_new.number_of_contained_points() == N)
+
+        all_positions = np.concatenate([self.positions, self.new_positions, [(-0.5, 0.5), (1.5, 2.5)]])
+        expected = direct_forces(self.queries, all_positions, np.ones(N))
+        assert(np.allclose(S_new.compute_forces(self.queries, theta=0.0), expected, rtol=1e-10))
+
+    def test_duplicate_positions(self):
+
+        # points at the same position, or one unit in the last place apart, share a leaf
+        duplicates = np.concatenate([np.full((20, 2), 0.5), self.positions[:20],
+                                     [(0.5, np.nextafter(0.5, 1)), (np.nextafter(0.3, 1), 0.3), (0.3, 0.3)]])
+        positions = np.concatenate([self.positions, duplicates])
+        T = VersionedQuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(positions)
+        S = T.snapshot()
+        assert(S.number_of_contained_points() == len(positions))
+        assert(S.total_mass() == len(positions))
+
+        expected = direct_forces(self.queries, positions, np.ones(len(positions)))
+        assert(np.allclose(S.compute_forces(self.queries, theta=0.0), expected, rtol=1e-10))
+
+        # every point is counted at its distance
+        distances = S.get_distances_to(tuple(self.queries[0]), theta=0.0)
+        assert(sum(c for d, c in distances) == len(positions))
+        assert(np.allclose(np.sort(np.repeat([d for d, c in distances], [c for d, c in distances])),
+                           direct_distances(self.queries[0], positions)))
+
+
+if __name__ == "__main__":
+
+    T = PersistentTest()
+    T.setUp()
+    T.test_snapshot_matches_direct_sum()
+    T.test_snapshots_dont_change()
+    T.test_duplicate_positions()
@@ -0,0 +1,52 @@
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent
+from cQuadTree.tests.brute_force import direct_forces, direct_potentials
+
+
+class QuantitiesTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(17)
+        self.positions = rng.random((3000, 2))
+        self.masses = 0.5 + rng.random(3000)
+        # the first queries coincide with points of the tree
+        self.queries = np.concatenate([self.positions[:20], rng.random((80, 2))])
+        self.T = QuadTree(Extent(0, 0, 1, 1))
+        self.T.insert_positions(self.positions.tolist(), self.masses.tolist())
+
+    def test_same_as_separate_queries(self):
+
+        for n_threads in [1, 4]:
+            result = self.T.compute_quantities(self.queries, theta=0.5, n_threads=n_threads)
+            assert(set(result.keys()) == {'force', 'potential'})
+            forces = np.array([ self.T.compute_force(tuple(q), 0.5) for q in self.queries ])
+            assert(np.allclose(result['force'], forces, rtol=1e-12))
+
+        result = self.T.compute_quantities(self.queries, theta=0.5, force=False, potential=False,
+                                           number_of_interactions=True)
+        assert(set(result.keys()) == {'number_of_interactions'})
+
+    def test_brute_force(self):
+
+        radius = 0.05
+        result = self.T.compute_quantities(self.queries, theta=0.0, radius=radius,
+                                           mass_within_radius=True, number_of_interactions=True)
+
+        assert(np.allclose(result['force'], direct_forces(self.queries, self.positions, self.masses), rtol=1e-10))
+        assert(np.allclose(result['potential'], direct_potentials(self.queries, self.positions, self.masses), rtol=1e-10))
+
+        # points at zero distance count towards the mass within the radius only
+        r = np.linalg.norm(self.positions[None, :, :] - self.queries[:, None, :], axis=2)
+        assert(np.allclose(result['mass_within_radius'], (self.masses[None, :] * (r <= radius)).sum(axis=1), rtol=1e-12))
+        assert(np.array_equal(result['number_of_interactions'], (r > 0).sum(axis=1)))
+
+
+if __name__ == "__main__":
+
+    T = QuantitiesTest()
+    T.setUp()
+    T.test_same_as_separate_queries()
+    T.test_brute_force()
@@ -0,0 +1,108 @@
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+from cQuadTree import QuadTree, Extent, get_extent_of_binary_file, build_tree_from_chunks
+from cQuadTree.tests.brute_force import direct_forces
+
+
+class StreamingTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(10)
+        self.positions = (-1.0, 2.0) + rng.random((3000, 2)) * (3.0, 1.5)
+        # the bounding box is exactly representable
+        self.positions[:2] = [(-1.0, 2.0), (2.0, 3.5)]
+        self.masses = 0.5 + rng.random(3000)
+        self.queries = (-1.0, 2.0) + rng.random((50, 2)) * (3.0, 1.5)
+
+    def get_one_shot_tree(self, extent, masses=None):
+        T = QuadTree(extent)
+        if masses is None:
+            T.insert_positions(position_pairs=self.positions.tolist())
+        else:
+            T.insert_positions(position_pairs=self.positions.tolist(), masses=masses.tolist())
+        return T
+
+    def assert_same_results(self, A, B, masses):
+        assert(A.number_of_contained_points == B.number_of_contained_points == len(self.positions))
+        assert(np.isclose(A.total_mass, B.total_mass, rtol=1e-12))
+        for q in self.queries[:10]:
+            q = tuple(q)
+            # the same points in the same order give the same tree
+            assert(A.compute_force(q, theta=0.5) == B.compute_force(q, theta=0.5))
+            assert(A.get_distances_to(q, theta=0.2) == B.get_distances_to(q, theta=0.2))
+        forces = np.array([ A.compute_force(tuple(q), theta=0.0) for q in self.queries ])
+        assert(np.allclose(forces, direct_forces(self.queries, self.positions, masses), rtol=1e-10))
+
+    def test_binary_file(self):
+
+        fd, filename = tempfile.mkstemp(suffix='.bin')
+        os.close(fd)
+        try:
+            self.positions.tofile(filename)
+
+            extent = get_extent_of_binary_file(filename, chunk_size=333)
+            assert((extent.left(), extent.bottom()) == (-1.0, 2.0))
+            assert((extent.width(), extent.height()) == (3.0, 3.0))
+
+            T = QuadTree(extent)
+            assert(T.insert_from_binary_file(filename, chunk_size=333) == len(self.positions))
+            self.assert_same_results(T, self.get_one_shot_tree(extent),
+                                     np.ones(len(self.positions)))
+
+            # slices of a read-only memory map are inserted in place
+            positions = np.memmap(filename, dtype=float, mode='r').reshape(-1, 2)
+            chunks = ( positions[i:i+333] for i in range(0, len(positions), 333) )
+            self.assert_same_results(build_tree_from_chunks(chunks, extent),
+                                     self.get_one_shot_tree(extent),
+                                     np.ones(len(self.positions)))
+            del positions
+        finally:
+            os.remove(filename)
+
+    def test_chunks(self):
+
+        extent = Extent(-1.0, 2.0, 3.0, 3.0)
+        one_shot = self.get_one_shot_tree(extent, self.masses)
+
+        chunks = [ (self.positions[i:i+700], self.masses[i:i+700])
+                   for i in range(0, len(self.positions), 700) ]
+        T = build_tree_from_chunks(chunks, extent)
+        self.assert_same_results(T, one_shot, self.masses)
+
+        # point ids are the positions' indices in the stream
+        chunks = ( self.positions[i:i+700] for i in range(0, len(self.positions), 700) )
+        T = build_tree_from_chunks(chunks, extent)
+        ids = []
+        nodes = [T]
+        while nodes:
+            node = nodes.pop()
+            if node.is_leaf():
+                ids.append(node.this_id)
+            nodes.extend(node.get_subtrees())
+        assert(sorted(ids) == list(range(len(self.positions))))
+
+    def test_64_bit_ids(self):
+
+        T = QuadTree(Extent(-1.0, 2.0, 3.0, 3.0))
+        T.insert_positions(self.positions[:10], 2**31 - 5)
+        T.insert_positions(self.positions[10:20], self.masses[10:20], 2**40)
+        ids = np.sort(T.export_arrays()['leaf_ids'])
+        assert(np.array_equal(ids, np.concatenate([2**31 - 5 + np.arange(10), 2**40 + np.arange(10)])))
+
+        # all ids are checked before any point is inserted
+        with self.assertRaises(OverflowError):
+            T.insert_positions(self.positions[20:30], 2**63 - 5)
+        assert(T.number_of_contained_points == 20)
+
+
+if __name__ == "__main__":
+
+    T = StreamingTest()
+    T.setUp()
+    T.test_binary_file()
+    T.test_chunks()
+    T.test_64_bit_ids()
@@ -0,0 +1,76 @@
+import json
+import unittest
+
+import numpy as np
+
+from cQuadTree import (QuadTree, Extent, enable_tracing, is_tracing_enabled, clear_trace,
+                       get_trace_events, get_chrome_trace, trace_summary)
+
+
+class TracingTest(unittest.TestCase):
+
+    def setUp(self):
+        rng = np.random.default_rng(22)
+        self.positions = rng.random((2000, 2))
+        self.queries = rng.random((400, 2))
+        clear_trace()
+
+    def tearDown(self):
+        enable_tracing(False)
+        clear_trace()
+
+    def run_pipeline(self):
+        T = QuadTree(Extent(0, 0, 1, 1))
+        T.insert_positions(self.positions)
+        T.compute_quantities(self.queries, theta=0.5, n_threads=4)
+
+    def test_spans(self):
+
+        # nothing is recorded while tracing is off
+        self.run_pipeline()
+        assert(get_trace_events() == [])
+
+        enable_tracing()
+        assert(is_tracing_enabled())
+        self.run_pipeline()
+        events = get_trace_events()
+        names = set(name for name, thread_id, start, duration in events)
+        assert({'insert', 'traverse'} <= names)
+        assert(all(duration >= 0 for name, thread_id, start, duration in events))
+
+        # every worker thread records its own span
+        summary = trace_summary(as_dict=True)
+        assert(summary['traverse']['count'] == 4)
+        assert(summary['traverse']['threads'] == 4)
+
+        trace = json.loads(get_chrome_trace())
+        assert(len(trace['traceEvents']) == len(events))
+
+    def test_clear(self):
+
+        enable_tracing()
+        for _ in range(5):
+            self.run_pipeline()
+        thread_ids = set(thread_id for name, thread_id, start, duration in get_trace_events())
+
+        clear_trace()
+        assert(get_trace_events() == [])
+
+        # threads of later calls get new ids, spans of exited threads are gone
+        self.run_pipeline()
+        events = get_trace_events()
+        assert(len(events) > 0)
+        traverse_ids = set(thread_id for name, thread_id, start, duration in events if name == 'traverse')
+        assert(len(traverse_ids) == 4)
+        assert(min(traverse_ids) > max(thread_ids))
+
+
+if __name__ == "__main__":
+
+    T = TracingTest()
+    T.setUp()
+    T.test_spans()
+    T.tearDown()
+    T.setUp()
+    T.test_clear()
+    T.tearDown()
@@ -1,5 +1,7 @@
 import numpy as np
 
+from _cQuadTree import weighted_histogram, get_trace_events, get_chrome_trace
+
 def histogram(data, counts, bin_edges, density=True):
     """
     Returns a histogram from distance count data
@@ -25,13 +27,10 @@ def histogram(data, counts, bin_edges, density=True):
         The used bin edges
     """
     bin_edges = np.sort(bin_edges)
-    new_counts = np.zeros(len(bin_edges)-1,dtype=int)
-    ndcs = np.searchsorted(bin_edges, data)
-    allowed_ndcs = np.where(np.logical_and(ndcs>0, ndcs<=len(new_counts)))
-    ndcs = ndcs[allowed_ndcs]
-    counts = counts[allowed_ndcs]
-    for ndx, C in zip(ndcs, counts):
-        new_counts[ndx-1] += C
+    new_counts = weighted_histogram(np.asarray(data, dtype=float),
+                                    np.asarray(counts).astype(np.int64),
+                                    bin_edges,
+                                    )
     if density:
         dx = np.diff(bin_edges)
         all_counts = new_counts.sum()
@@ -39,13 +38,58 @@ def histogram(data, counts, bin_edges, density=True):
 
     return new_counts, bin_edges
 
+def estimate_distance_histogram(quadtree, bin_edges, sample_budget=1000, theta=0.2, density=True, seed=0):
+    """
+    Estimate the distribution of pairwise distances between the
+    points in a tree from a stratified sample of query points.
+
+    Parameters
+    ==========
+    quadtree : :class:`_cQuadTree.QuadTree`
+        The tree containing the points
+    bin_edges : numpy.ndarray
+        Edges of bins for which the histogram should be computed
+    sample_budget : int, default = 1000
+        Number of query points to evaluate, trades
+        accuracy for time
+    theta : float, default = 0.2
+        Barnes-Hut cutoff parameter of the distance queries
+    density : boolean, default = True
+        Whether or not to make the histogram a probability density
+    seed : int, default = 0
+        Seed of the random number generators
+
+    Returns
+    =======
+    hist : numpy.ndarray
+        Either the estimated number of (ordered) point pairs per bin,
+        or the estimated pdf, will have length ``len(bin_edges)-1``.
+    std : numpy.ndarray
+        Estimated standard error of every entry of ``hist``
+    bin_edges : numpy.ndarray
+        The used bin edges
+    """
+    bin_edges = np.sort(bin_edges)
+    hist, variance = quadtree.estimate_distance_histogram(bin_edges,
+                                                          sample_budget=sample_budget,
+                                                          theta=theta,
+                                                          seed=seed,
+                                                          )
+    std = np.sqrt(variance)
+    if density:
+        norm = np.diff(bin_edges) * hist.sum()
+        hist = hist / norm
+        std = std / norm
+
+    return hist, std, bin_edges
+
 def slow_histogram(data, counts, bin_edges, density=True):
     new_data = [ np.ones(int(c))*r for r, c in zip(data, counts) ]
     new_data = np.concatenate(new_data)
 
     return np.histogram(new_data,bins=bin_edges,density=density)
 
-def get_points_and_boxes(quadtree):
+def get_points_and_boxes(quadtree, as_arrays=False):
     """
     Returns two lists, one filled with "Extent" objects
     representing the boxes of the tree that are occupied,
@@ -56,15 +100,33 @@ def get_points_and_boxes(quadtree):
     ==========
     quadtree : :class:`_cQuadTree.QuadTree`
         Self-explanatory, no?
+    as_arrays : bool, default = False
+        If ``True``, collect points and boxes in a single native
+        call and return them as NumPy arrays, which is much
+        faster for large trees.
 
     Returns
     =======
     points : list of :class:`_cQuadTree.Point`
-        Points located at the leaves ot the tree
+        Points located at the leaves ot the tree.
+        If ``as_arrays = True``, this is a numpy.ndarray
+        of shape ``(n_leaves, 2)``.
     boxes : list of :class:`_cQuadTree.Extent`
-        The boxes that internal tree nodes represent
+        The boxes that internal tree nodes represent.
+        If ``as_arrays = True``, this is a numpy.ndarray
+        of shape ``(n_nodes, 4)`` where each row
+        contains ``(left, bottom, width, height)``.
     """
 
+    if as_arrays:
+        arrays = quadtree.export_arrays()
+        boxes = np.column_stack((arrays['left'],
+                                 arrays['bottom'],
+                                 arrays['width'],
+                                 arrays['height'],
+                                ))
+        return arrays['leaf_positions'], boxes
+
     points = []
     boxes = []
     if quadtree.is_leaf():
@@ -77,6 +139,115 @@ def get_points_and_boxes(quadtree):
 
     return points, boxes
 
+def build_tree_from_chunks(chunks, extent):
+    """
+    Build a tree from an iterable of position chunks without
+    having to hold all input positions in memory at once. The
+    tree itself holds every point, so its memory grows linearly
+    with the total number of points.
+
+    Parameters
+    ==========
+    chunks : iterable
+        Every item is either an array-like of shape ``(n, 2)``
+        containing positions or a 2-tuple ``(positions, masses)``.
+        Can be e.g. a generator that reads slices of a
+        ``numpy.memmap``. C-contiguous float64 chunks are
+        inserted without being copied.
+    extent : :class:`_cQuadTree.Extent`
+        The root extent of the tree. Has to contain all positions,
+        e.g. computed in a first pass with
+        :func:`_cQuadTree.get_extent_of_binary_file`.
+
+    Returns
+    =======
+    tree : :class:`_cQuadTree.QuadTree`
+        The tree containing all positions, where the point ids
+        correspond to the positions' index in the stream.
+    """
+    from _cQuadTree import QuadTree
+
+    tree = QuadTree(extent)
+    first_id = 0
+    for chunk in chunks:
+        if isinstance(chunk, tuple):
+            positions, masses = chunk
+            positions = np.ascontiguousarray(positions, dtype=float).reshape(-1, 2)
+            tree.insert_positions(positions, np.ascontiguousarray(masses, dtype=float), first_id)
+        else:
+            positions = np.ascontiguousarray(chunk, dtype=float).reshape(-1, 2)
+            tree.insert_positions(positions, first_id)
+        first_id += len(positions)
+
+    return tree
+
+
+def write_chrome_trace(filename):
+    """
+    Write all recorded spans of pipeline phases (see
+    :func:`_cQuadTree.enable_tracing`) to a file in the Chrome
+    trace-event format, to be loaded into ``chrome://tracing``
+    or Perfetto.
+
+    Parameters
+    ==========
+    filename : str
+        Path of the JSON file
+    """
+    with open(filename, 'w') as f:
+        f.write(get_chrome_trace())
+
+def trace_summary(as_dict=False):
+    """
+    Summarize the recorded spans of pipeline phases (see
+    :func:`_cQuadTree.enable_tracing`) per phase.
+
+    Parameters
+    ==========
+    as_dict : bool, default = False
+        If ``True``, return the summary as a dictionary
+        instead of a printable table.
+
+    Returns
+    =======
+    summary : str or dict
+        For every phase, the number of spans, the number of threads
+        that recorded them, the total, mean, and maximum duration of
+        a span in milliseconds, and the wall time in milliseconds
+        between the start of the first and the end of the last span.
+        Phases are sorted by total duration. If ``as_dict = True``,
+        a dictionary that maps phase names to dictionaries with the
+        keys ``'count'``, ``'threads'``, ``'total'``, ``'mean'``,
+        ``'max'``, and ``'wall'``.
+    """
+    phases = {}
+    for name, thread_id, start, duration in get_trace_events():
+        phases.setdefault(name, []).append((thread_id, start, duration))
+
+    summary = {}
+    for name, spans in phases.items():
+        durations = [ span[2] / 1000 for span in spans ]
+        starts = [ span[1] / 1000 for span in spans ]
+        summary[name] = {
+                'count': len(spans),
+                'threads': len(set(span[0] for span in spans)),
+                'total': sum(durations),
+                'mean': sum(durations) / len(spans),
+                'max': max(durations),
+                'wall': max(s + d for s, d in zip(starts, durations)) - min(starts),
+            }
+
+    if as_dict:
+        return summary
+
+    columns = ['count', 'threads', 'total', 'mean', 'max', 'wall']
+    lines = [ '{:<14s}'.format('phase') + ''.join('{:>12s}'.format(c) for c in columns) ]
+    for name, row in sorted(summary.items(), key=lambda item: -item[1]['total']):
+        lines.append('{:<14s}{:>12d}{:>12d}'.format(name, row['count'], row['threads'])
+                     + ''.join('{:>12.3f}'.format(row[c]) for c in columns[2:]))
+
+    return '\n'.join(lines)
+
 
 if __name__=="__main__":
 
@@ -86,6 +257,6 @@ if __name__=="__main__":
 
     points = np.random.rand(100,2).tolist()
     T = QuadTree(points)
-    points, boxes = get_points_and_boxes(T)
+    points, boxes = get_points_and_boxes(T, as_arrays=True)
     plot_box_tree(points, boxes)
     pl.show()
@@ -79,8 +79,13 @@ class BuildExt(build_ext):
             opts.append(cpp_flag(self.compiler))
             if has_flag(self.compiler, '-fvisibility=hidden'):
                 opts.append('-fvisibility=hidden')
+        link_opts = []
+        if ct == 'unix' and has_flag(self.compiler, '-pthread'):
+            opts.append('-pthread')
+            link_opts.append('-pthread')
         for ext in self.extensions:
             ext.extra_compile_args = opts
+            ext.extra_link_args = link_opts
         build_ext.build_extensions(self)
 
 setup(